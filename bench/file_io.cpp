@@ -0,0 +1,113 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+/*
+  Writes and then reads back a scratch file through each file I/O engine the
+  client supports, the way a transfer does, and reports throughput and the
+  number of I/O system calls issued. Page cache is dropped between the write
+  and the read so reads come from the device.
+ */
+
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+#include "crypto.h"
+#include "storage.h"
+
+double now() {
+
+    timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+void drop_cache(const std::string &path) {
+
+    int fd = open(path.c_str(), O_RDONLY);
+
+    if (fd < 0)
+        throw std::runtime_error("can't read file");
+    fdatasync(fd);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    close(fd);
+}
+
+void report(const std::string &name, const std::string &phase, long size, double elapsed, long syscalls) {
+    std::cout << std::left << std::setw(10) << name << std::setw(6) << phase << std::right << std::setw(10) << std::fixed << std::setprecision(2) << size / elapsed / 1e9 << " GB/s" << std::setw(10) << syscalls << " syscalls" << std::endl;
+}
+
+void run(int mode, const std::string &path, long size) {
+
+    long syscalls, offset;
+    double start_time;
+    std::ofstream file(path.c_str(), std::ofstream::trunc);
+    Storage storage;
+    block_t block(block_t::data, __data_size);
+
+    file.close();
+    for (int i = 0; i < block._size; i++)
+        block._data[i] = i * 7;
+    storage.set_mode(mode);
+    syscalls = Storage::syscalls();
+    start_time = now();
+    storage.open_write(path, 0, size);
+    for (offset = 0; offset < size; offset += block._size) {
+        block._size = std::min(size - offset, (long) __data_size);
+        if (!storage.write(block))
+            throw std::runtime_error("can't write file");
+    }
+    if (!storage.flush())
+        throw std::runtime_error("can't write file");
+    storage.close();
+    report(Storage::mode_name(mode), "write", size, now() - start_time, Storage::syscalls() - syscalls);
+    drop_cache(path);
+    syscalls = Storage::syscalls();
+    start_time = now();
+    storage.open_read(path, 0);
+    for (offset = 0; offset < size; offset += block._size)
+        if (!storage.read(block, std::min(size - offset, (long) __data_size)))
+            throw std::runtime_error("can't read file");
+    storage.close();
+    report(Storage::mode_name(mode), "read", size, now() - start_time, Storage::syscalls() - syscalls);
+    unlink(path.c_str());
+}
+
+int main(int argc, char **argv) {
+
+    long size = 256;
+    std::string string, path = "bench_file_io.tmp";
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            string = argv[i];
+            if (string == "-s" && i + 1 < argc)
+                size = atol(argv[++i]);
+            else if (string == "-f" && i + 1 < argc)
+                path = argv[++i];
+            else
+                throw std::runtime_error("unknown argument " + string);
+        }
+        if (size < 1)
+            throw std::runtime_error("invalid size");
+        for (int mode = __storage_buffered; mode <= __storage_uring; mode++)
+            run(mode, path, size * 1024 * 1024);
+    } catch (const std::exception &exception) {
+        std::cerr << "Error: " << exception.what() << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
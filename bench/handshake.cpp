@@ -0,0 +1,153 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+/*
+  Runs the key agreement of a session between two in-process Crypto objects
+  and reports handshakes per second for each key exchange the client supports,
+  including a session resumed from a ticket.
+ */
+
+#include <iomanip>
+#include <iostream>
+#include <time.h>
+#include "crypto.h"
+
+#define __bench_seconds 2
+
+std::string initiator_ticket, responder_ticket;
+
+double now() {
+
+    timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+void verify(Crypto &initiator, Crypto &responder) {
+
+    const char message[] = "handshake";
+    block_t plain(block_t::data, message, sizeof message), cipher, result;
+
+    initiator.encrypt_block(cipher, plain);
+    responder.decrypt_block(result, cipher);
+    if (result._size != plain._size || memcmp(result._data, plain._data, plain._size))
+        throw std::runtime_error("session keys differ");
+}
+
+void dh_handshake(int group) {
+
+    Crypto initiator, responder;
+    block_t initiator_key, responder_key, block;
+
+    initiator.get_group(block, group);
+    responder.set_group(block);
+    initiator.get_public_key(initiator_key);
+    responder.get_public_key(responder_key);
+    initiator.set_public_key(responder_key);
+    responder.set_public_key(initiator_key);
+    initiator.get_init_vector(block);
+    initiator.set_init_vector(block);
+    responder.set_init_vector(block);
+    verify(initiator, responder);
+}
+
+void ffdhe2048_handshake() {
+    dh_handshake(__group_ffdhe2048);
+}
+
+void ffdhe3072_handshake() {
+    dh_handshake(__group_ffdhe3072);
+}
+
+void modp2048_handshake() {
+    dh_handshake(__group_modp2048);
+}
+
+void ecdh_handshake() {
+
+    Crypto initiator, responder;
+    block_t initiator_key, responder_key, block;
+
+    initiator.get_ecdh_key(initiator_key);
+    responder.get_ecdh_key(responder_key);
+    initiator.set_ecdh_key(responder_key);
+    responder.set_ecdh_key(initiator_key);
+    initiator.get_init_vector(block);
+    initiator.set_init_vector(block);
+    responder.set_init_vector(block);
+    verify(initiator, responder);
+}
+
+void issue_tickets() {
+
+    Crypto initiator, responder;
+    block_t initiator_key, responder_key, block;
+
+    initiator.get_ecdh_key(initiator_key);
+    responder.get_ecdh_key(responder_key);
+    initiator.set_ecdh_key(responder_key);
+    responder.set_ecdh_key(initiator_key);
+    initiator.get_init_vector(block);
+    initiator.set_init_vector(block);
+    responder.set_init_vector(block);
+    initiator_ticket = initiator.get_ticket();
+    responder_ticket = responder.get_ticket();
+}
+
+void resume_handshake() {
+
+    Crypto initiator, responder;
+    unsigned char nonces[64];
+    std::string initiator_binder, responder_binder;
+
+    RAND_bytes(nonces, sizeof nonces);
+    initiator_binder = Crypto::bind_ticket(initiator_ticket, nonces, 32);
+    responder_binder = Crypto::bind_ticket(responder_ticket, nonces + 32, 32);
+    if (Crypto::bind_ticket(responder_ticket, nonces, 32) != initiator_binder || Crypto::bind_ticket(initiator_ticket, nonces + 32, 32) != responder_binder)
+        throw std::runtime_error("can't resume session");
+    initiator.resume_session(initiator_ticket, std::string((char *) nonces, sizeof nonces));
+    responder.resume_session(responder_ticket, std::string((char *) nonces, sizeof nonces));
+    verify(initiator, responder);
+}
+
+void run(const std::string &name, void (*handshake)()) {
+
+    long count = 0;
+    double start_time = now(), elapsed;
+
+    do {
+        handshake();
+        count++;
+        elapsed = now() - start_time;
+    } while (elapsed < __bench_seconds);
+    std::cout << std::left << std::setw(12) << name << std::right << std::setw(10) << std::fixed << std::setprecision(1) << count / elapsed << " handshakes/s" << std::setw(10) << std::setprecision(3) << elapsed / count * 1e3 << " ms/handshake" << std::endl;
+}
+
+int main(int argc, char **argv) {
+    try {
+        Crypto::load_groups("/dev/null");
+        run("ffdhe2048", ffdhe2048_handshake);
+        run("ffdhe3072", ffdhe3072_handshake);
+        run("modp2048", modp2048_handshake);
+        run("x25519", ecdh_handshake);
+        issue_tickets();
+        run("resume", resume_handshake);
+    } catch (const std::exception &exception) {
+        std::cerr << "Error: " << exception.what() << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,283 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+/*
+  Starts a relay and two clients on loopback, drives the clients through
+  their terminals and measures handshake latency, chat round trip time and
+  file transfer throughput. Each run appends one JSON object to the results
+  file so numbers can be compared between revisions.
+ */
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <iostream>
+#include <algorithm>
+#include <stdexcept>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <poll.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define __bench_timeout 300
+#define __bench_chunk   1024 * 1024
+
+struct process_t {
+    pid_t pid;
+    int in, out;
+    std::string output;
+};
+
+std::vector<process_t *> processes;
+
+double now() {
+
+    timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+void spawn(process_t &process, const std::vector<std::string> &args, const std::string &home) {
+
+    int in[2], out[2];
+    std::vector<char *> argv;
+
+    if (pipe(in) || pipe(out))
+        throw std::runtime_error("can't create pipe");
+    process.pid = fork();
+    if (process.pid < 0)
+        throw std::runtime_error("can't fork");
+    if (!process.pid) {
+        dup2(in[0], STDIN_FILENO);
+        dup2(out[1], STDOUT_FILENO);
+        dup2(out[1], STDERR_FILENO);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        if (home.size())
+            setenv("HOME", home.c_str(), 1);
+        for (size_t i = 0; i < args.size(); i++)
+            argv.push_back((char *) args[i].c_str());
+        argv.push_back(NULL);
+        execv(argv[0], &argv[0]);
+        _exit(EXIT_FAILURE);
+    }
+    close(in[0]);
+    close(out[1]);
+    process.in = in[1];
+    process.out = out[0];
+    processes.push_back(&process);
+}
+
+void write_line(process_t &process, const std::string &line) {
+
+    std::string data = line + "\n";
+
+    if (write(process.in, data.c_str(), data.size()) != (ssize_t) data.size())
+        throw std::runtime_error("can't write to client");
+}
+
+size_t wait_output(process_t &process, const std::string &pattern, size_t start) {
+
+    char buffer[65536];
+    double deadline = now() + __bench_timeout;
+    size_t pos;
+    ssize_t bytes;
+    std::vector<pollfd> fds(processes.size());
+
+    while ((pos = process.output.find(pattern, start)) == std::string::npos) {
+        if (now() > deadline)
+            throw std::runtime_error("timed out waiting for \"" + pattern + "\"");
+        for (size_t i = 0; i < processes.size(); i++) {
+            fds[i].fd = processes[i]->out;
+            fds[i].events = POLLIN;
+        }
+        if (poll(&fds[0], fds.size(), 1000) < 0)
+            throw std::runtime_error("can't poll clients");
+        for (size_t i = 0; i < processes.size(); i++)
+            if (fds[i].revents) {
+                bytes = read(fds[i].fd, buffer, sizeof buffer);
+                if (bytes > 0)
+                    processes[i]->output.append(buffer, bytes);
+                else if (processes[i] == &process)
+                    throw std::runtime_error("client exited waiting for \"" + pattern + "\":\n" + process.output.substr(process.output.size() > 500 ? process.output.size() - 500 : 0));
+            }
+    }
+    return pos + pattern.size();
+}
+
+void write_file(const std::string &path, long size) {
+
+    std::vector<unsigned int> chunk(__bench_chunk / sizeof (unsigned int));
+    std::ofstream file(path.c_str(), std::ofstream::binary);
+    unsigned int seed = size;
+
+    while (size > 0) {
+        for (size_t i = 0; i < chunk.size(); i++)
+            chunk[i] = rand_r(&seed);
+        file.write((char *) &chunk[0], std::min(size, (long) __bench_chunk));
+        size -= __bench_chunk;
+    }
+    if (!file)
+        throw std::runtime_error("can't write " + path);
+}
+
+bool same_files(const std::string &first, const std::string &second) {
+
+    std::vector<char> first_data(__bench_chunk), second_data(__bench_chunk);
+    std::ifstream first_file(first.c_str(), std::ifstream::binary), second_file(second.c_str(), std::ifstream::binary);
+
+    while (first_file && second_file) {
+        first_file.read(&first_data[0], first_data.size());
+        second_file.read(&second_data[0], second_data.size());
+        if (first_file.gcount() != second_file.gcount() || memcmp(&first_data[0], &second_data[0], first_file.gcount()))
+            return false;
+    }
+    return first_file.eof() && second_file.eof();
+}
+
+double percentile(std::vector<double> samples, double fraction) {
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t) (fraction * samples.size()))];
+}
+
+int main(int argc, char **argv) {
+
+    int port = 47600, rounds = 200;
+    char directory[] = "/tmp/safechat_bench.XXXXXX";
+    double start_time, handshake_time;
+    size_t alice_pos, bob_pos;
+    std::string string, dir, config, results_path = "bench_results.jsonl", sizes_string = "1,16,64";
+    std::vector<long> sizes;
+    std::vector<double> round_trips, transfer_times;
+    std::stringstream sizes_stream, json;
+    std::ofstream file;
+    process_t relay, alice, bob;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            string = argv[i];
+            if (string == "-p" && i + 1 < argc)
+                port = atoi(argv[++i]);
+            else if (string == "-r" && i + 1 < argc)
+                rounds = atoi(argv[++i]);
+            else if (string == "-s" && i + 1 < argc)
+                sizes_string = argv[++i];
+            else if (string == "-c" && i + 1 < argc)
+                config += std::string(argv[++i]) + "\n";
+            else if (string == "-o" && i + 1 < argc)
+                results_path = argv[++i];
+            else
+                throw std::runtime_error("unknown argument " + string);
+        }
+        if (rounds < 1)
+            throw std::runtime_error("invalid number of rounds");
+        sizes_stream.str(sizes_string);
+        while (std::getline(sizes_stream, string, ','))
+            sizes.push_back(atol(string.c_str()) * 1024 * 1024);
+    } catch (const std::exception &exception) {
+        std::cout << "SafeChat loopback benchmark\n\n    -p <port> Specifies the relay port\n    -r <num>  Specifies the number of chat round trips\n    -s <list> Specifies the file sizes in MiB (comma separated)\n    -c <conf> Adds a line to both client configuration files\n    -o <path> Specifies the results file\n" << std::endl;
+        std::cerr << "Error: " << exception.what() << ".\n";
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    try {
+        if (!mkdtemp(directory))
+            throw std::runtime_error("can't create working directory");
+        dir = directory;
+        mkdir((dir + "/alice").c_str(), 0700);
+        mkdir((dir + "/bob").c_str(), 0700);
+        std::ofstream((dir + "/alice/.safechat").c_str()) << config;
+        std::ofstream((dir + "/bob/.safechat").c_str()) << config;
+        string = std::to_string(port);
+        spawn(relay, {"./safechat_relay", "-p", string}, "");
+        wait_output(relay, "Listening", 0);
+        spawn(alice, {"./safechat", "-n", "alice", "-s", "127.0.0.1", "-p", string, "-f", dir + "/alice"}, dir + "/alice");
+        alice_pos = wait_output(alice, "Choice: ", 0);
+        write_line(alice, "1");
+        alice_pos = wait_output(alice, "Waiting for peer", alice_pos);
+        spawn(bob, {"./safechat", "-n", "bob", "-s", "127.0.0.1", "-p", string, "-f", dir + "/bob"}, dir + "/bob");
+        bob_pos = wait_output(bob, "Choice: ", 0);
+        write_line(bob, "2");
+        bob_pos = wait_output(bob, "Choice: ", wait_output(bob, "Peers:", bob_pos));
+        start_time = now();
+        write_line(bob, "1");
+        alice_pos = wait_output(alice, "Commands:", alice_pos);
+        bob_pos = wait_output(bob, "Commands:", bob_pos);
+        handshake_time = now() - start_time;
+        for (int i = 0; i < rounds; i++) {
+            string = std::to_string(i);
+            start_time = now();
+            write_line(alice, "ping " + string);
+            bob_pos = wait_output(bob, "alice: ping " + string + "\n", bob_pos);
+            write_line(bob, "pong " + string);
+            alice_pos = wait_output(alice, "bob: pong " + string + "\n", alice_pos);
+            round_trips.push_back(now() - start_time);
+        }
+        for (size_t i = 0; i < sizes.size(); i++) {
+            string = "/transfer_" + std::to_string(sizes[i]);
+            write_file(dir + string, sizes[i]);
+            write_line(alice, dir + string);
+            bob_pos = wait_output(bob, "(y/n) ", bob_pos);
+            start_time = now();
+            write_line(bob, "y");
+            bob_pos = wait_output(bob, "\nbob: ", bob_pos);
+            transfer_times.push_back(now() - start_time);
+            alice_pos = wait_output(alice, "\nalice: ", alice_pos);
+            if (!same_files(dir + string, dir + "/bob" + string))
+                throw std::runtime_error("received file differs");
+            unlink((dir + string).c_str());
+            unlink((dir + "/bob" + string).c_str());
+        }
+        write_line(alice, "");
+        wait_output(bob, "Disconnected.", bob_pos);
+    } catch (const std::exception &exception) {
+        for (size_t i = 0; i < processes.size(); i++)
+            kill(processes[i]->pid, SIGKILL);
+        std::cerr << "Error: " << exception.what() << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    kill(relay.pid, SIGTERM);
+    for (size_t i = 0; i < processes.size(); i++)
+        waitpid(processes[i]->pid, NULL, 0);
+    unlink((dir + "/alice/.safechat").c_str());
+    unlink((dir + "/bob/.safechat").c_str());
+    rmdir((dir + "/alice").c_str());
+    rmdir((dir + "/bob").c_str());
+    rmdir(dir.c_str());
+    std::replace(config.begin(), config.end(), '\n', ';');
+    std::cout << std::fixed << std::setprecision(2) << "handshake      " << std::setw(10) << handshake_time * 1e3 << " ms\nchat rtt p50   " << std::setw(10) << percentile(round_trips, 0.5) * 1e6 << " us\nchat rtt p99   " << std::setw(10) << percentile(round_trips, 0.99) * 1e6 << " us" << std::endl;
+    json << std::fixed << std::setprecision(3) << "{\"time\": " << time(NULL) << ", \"config\": \"" << config << "\", \"handshake_ms\": " << handshake_time * 1e3 << ", \"chat_rtt_us\": {\"rounds\": " << rounds << ", \"p50\": " << percentile(round_trips, 0.5) * 1e6 << ", \"p99\": " << percentile(round_trips, 0.99) * 1e6 << "}, \"transfer\": [";
+    for (size_t i = 0; i < sizes.size(); i++) {
+        std::cout << "transfer " << std::setw(5) << sizes[i] / (1024 * 1024) << " MiB" << std::setw(7) << sizes[i] / transfer_times[i] / 1e9 << " GB/s" << std::endl;
+        json << (i ? ", " : "") << "{\"bytes\": " << sizes[i] << ", \"seconds\": " << transfer_times[i] << ", \"gb_per_s\": " << sizes[i] / transfer_times[i] / 1e9 << "}";
+    }
+    json << "]}";
+    file.open(results_path.c_str(), std::ofstream::app);
+    file << json.str() << std::endl;
+    if (!file) {
+        std::cerr << "Error: can't write " << results_path << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
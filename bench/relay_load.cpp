@@ -0,0 +1,306 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+/*
+  Load generator for safechat_relay. For each relay thread count it starts a
+  relay, pairs up many raw protocol clients from several worker threads,
+  then streams opaque bytes in both directions through every pair and
+  reports pairing rate and forwarded throughput.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "block.h"
+
+#define __load_buffer_size  64 * 1024
+
+struct worker_t {
+    int port, first, count, seconds;
+    long bytes;
+    std::string error;
+    std::vector<int> sockets;
+};
+
+double now() {
+
+    timespec time;
+
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return time.tv_sec + time.tv_nsec / 1e9;
+}
+
+void read_all(int socket, void *data, int size) {
+
+    ssize_t bytes;
+
+    while (size) {
+        bytes = recv(socket, data, size, 0);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            throw std::runtime_error("connection dropped");
+        data = (char *) data + bytes;
+        size -= bytes;
+    }
+}
+
+void send_block(int socket, block_t::cmd_t cmd, const void *data, int size) {
+
+    std::string frame((char *) &cmd, sizeof cmd);
+
+    frame.append((char *) &size, sizeof size);
+    frame.append((const char *) data, size);
+    if (send(socket, frame.data(), frame.size(), MSG_NOSIGNAL) != (ssize_t) frame.size())
+        throw std::runtime_error("can't send block");
+}
+
+std::string recv_block(int socket, block_t::cmd_t &cmd) {
+
+    int size;
+    std::string data;
+
+    read_all(socket, &cmd, sizeof cmd);
+    read_all(socket, &size, sizeof size);
+    if (size < 0 || size > __block_size)
+        throw std::runtime_error("oversized block received");
+    data.resize(size);
+    read_all(socket, &data[0], size);
+    return data;
+}
+
+int join(int port, const std::string &name) {
+
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    block_t::cmd_t cmd;
+    sockaddr_in addr;
+
+    memset(&addr, 0, sizeof addr);
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (client < 0 || connect(client, (sockaddr *) & addr, sizeof addr))
+        throw std::runtime_error("can't connect to relay");
+    recv_block(client, cmd);
+    if (recv_block(client, cmd)[0])
+        throw std::runtime_error("relay is full");
+    send_block(client, block_t::name, name.c_str(), name.size() + 1);
+    return client;
+}
+
+void pair(worker_t &worker, int index) {
+
+    int waiting, connecting, hosts_size, id = -1, host_id;
+    std::string name = "peer" + std::to_string(index), data;
+    block_t::cmd_t cmd;
+
+    waiting = join(worker.port, name);
+    send_block(waiting, block_t::add, NULL, 0);
+    connecting = join(worker.port, "connector" + std::to_string(index));
+    while (id < 0) {
+        send_block(connecting, block_t::list, NULL, 0);
+        data = recv_block(connecting, cmd);
+        memcpy(&hosts_size, data.data(), sizeof hosts_size);
+        for (int i = 0; i < hosts_size; i++) {
+            data = recv_block(connecting, cmd);
+            memcpy(&host_id, data.data(), sizeof host_id);
+            if (recv_block(connecting, cmd) == name + std::string(1, '\0'))
+                id = host_id;
+        }
+    }
+    send_block(connecting, block_t::connect, &id, sizeof id);
+    recv_block(connecting, cmd);
+    if (cmd != block_t::connect)
+        throw std::runtime_error("pairing failed");
+    recv_block(waiting, cmd);
+    if (cmd != block_t::connect)
+        throw std::runtime_error("pairing failed");
+    worker.sockets.push_back(waiting);
+    worker.sockets.push_back(connecting);
+}
+
+void *setup(void *data) {
+
+    worker_t *worker = (worker_t *) data;
+
+    try {
+        for (int i = 0; i < worker->count; i++)
+            pair(*worker, worker->first + i);
+    } catch (const std::exception &exception) {
+        worker->error = exception.what();
+    }
+    return NULL;
+}
+
+void *stream(void *data) {
+
+    int epoll_fd = epoll_create1(0), events_size;
+    char buffer[__load_buffer_size];
+    double end_time = now() + ((worker_t *) data)->seconds;
+    ssize_t bytes;
+    epoll_event event, events[256];
+    worker_t *worker = (worker_t *) data;
+
+    memset(buffer, 0x5a, sizeof buffer);
+    for (size_t i = 0; i < worker->sockets.size(); i++) {
+        event.events = EPOLLIN | EPOLLOUT;
+        event.data.fd = worker->sockets[i];
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, worker->sockets[i], &event);
+    }
+    while (now() < end_time) {
+        events_size = epoll_wait(epoll_fd, events, 256, 100);
+        for (int i = 0; i < events_size; i++) {
+            if (events[i].events & EPOLLIN) {
+                bytes = recv(events[i].data.fd, buffer, sizeof buffer, MSG_DONTWAIT);
+                if (bytes > 0)
+                    worker->bytes += bytes;
+            }
+            if (events[i].events & EPOLLOUT)
+                send(events[i].data.fd, buffer, sizeof buffer, MSG_DONTWAIT | MSG_NOSIGNAL);
+        }
+    }
+    close(epoll_fd);
+    return NULL;
+}
+
+void run(int threads, int port, int pairs, int workers_size, int seconds) {
+
+    int out[2];
+    char buffer[256];
+    double start_time, setup_time;
+    long bytes = 0;
+    pid_t relay;
+    std::string output, string;
+    std::vector<worker_t> workers(workers_size);
+    std::vector<pthread_t> worker_threads(workers_size);
+
+    if (pipe(out))
+        throw std::runtime_error("can't create pipe");
+    relay = fork();
+    if (!relay) {
+        dup2(out[1], STDOUT_FILENO);
+        close(out[0]);
+        close(out[1]);
+        string = std::to_string(threads);
+        execl("./safechat_relay", "./safechat_relay", "-p", std::to_string(port).c_str(), "-t", string.c_str(), "-c", std::to_string(2 * pairs + 16).c_str(), (char *) NULL);
+        _exit(EXIT_FAILURE);
+    }
+    close(out[1]);
+    while (output.find("Listening") == std::string::npos) {
+        ssize_t size = read(out[0], buffer, sizeof buffer);
+        if (size <= 0)
+            throw std::runtime_error("relay didn't start");
+        output.append(buffer, size);
+    }
+    for (int i = 0; i < workers_size; i++) {
+        workers[i].port = port;
+        workers[i].first = pairs * i / workers_size;
+        workers[i].count = pairs * (i + 1) / workers_size - workers[i].first;
+        workers[i].seconds = seconds;
+        workers[i].bytes = 0;
+    }
+    start_time = now();
+    for (int i = 0; i < workers_size; i++)
+        pthread_create(&worker_threads[i], NULL, setup, &workers[i]);
+    for (int i = 0; i < workers_size; i++)
+        pthread_join(worker_threads[i], NULL);
+    setup_time = now() - start_time;
+    for (int i = 0; i < workers_size; i++)
+        if (workers[i].error.size()) {
+            kill(relay, SIGKILL);
+            waitpid(relay, NULL, 0);
+            throw std::runtime_error(workers[i].error);
+        }
+    for (int i = 0; i < workers_size; i++)
+        pthread_create(&worker_threads[i], NULL, stream, &workers[i]);
+    for (int i = 0; i < workers_size; i++) {
+        pthread_join(worker_threads[i], NULL);
+        bytes += workers[i].bytes;
+        for (size_t j = 0; j < workers[i].sockets.size(); j++)
+            close(workers[i].sockets[j]);
+    }
+    kill(relay, SIGTERM);
+    waitpid(relay, NULL, 0);
+    close(out[0]);
+    std::cout << std::setw(8) << threads << std::setw(8) << pairs << std::fixed << std::setprecision(0) << std::setw(14) << pairs / setup_time << std::setprecision(1) << std::setw(14) << bytes / (double) seconds / 1e6 << std::endl;
+}
+
+int main(int argc, char **argv) {
+
+    int port = 47700, pairs = 1000, seconds = 5, workers = sysconf(_SC_NPROCESSORS_ONLN);
+    std::string string;
+    std::vector<int> threads;
+    std::stringstream threads_stream;
+    rlimit limit;
+
+    try {
+        for (int i = 1; i < argc; i++) {
+            string = argv[i];
+            if (string == "-p" && i + 1 < argc)
+                port = atoi(argv[++i]);
+            else if (string == "-n" && i + 1 < argc)
+                pairs = atoi(argv[++i]);
+            else if (string == "-d" && i + 1 < argc)
+                seconds = atoi(argv[++i]);
+            else if (string == "-w" && i + 1 < argc)
+                workers = atoi(argv[++i]);
+            else if (string == "-t" && i + 1 < argc) {
+                threads_stream.str(argv[++i]);
+                while (std::getline(threads_stream, string, ','))
+                    threads.push_back(atoi(string.c_str()));
+            } else
+                throw std::runtime_error("unknown argument " + string);
+        }
+        if (pairs < 1 || seconds < 1 || workers < 1)
+            throw std::runtime_error("invalid argument");
+        if (threads.empty())
+            for (int i = 1; i <= sysconf(_SC_NPROCESSORS_ONLN); i *= 2)
+                threads.push_back(i);
+    } catch (const std::exception &exception) {
+        std::cout << "SafeChat relay load generator\n\n    -p <port> Specifies the relay port\n    -n <num>  Specifies the number of client pairs\n    -d <sec>  Specifies the streaming duration\n    -w <num>  Specifies the number of generator threads\n    -t <list> Specifies the relay thread counts to test (comma separated)\n" << std::endl;
+        std::cerr << "Error: " << exception.what() << ".\n";
+        return EXIT_FAILURE;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    std::cout << " threads   pairs   pairings/s          MB/s" << std::endl;
+    try {
+        for (size_t i = 0; i < threads.size(); i++)
+            run(threads[i], port + i, pairs, workers, seconds);
+    } catch (const std::exception &exception) {
+        std::cerr << "Error: " << exception.what() << "." << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -17,51 +17,113 @@
 #define	block_h
 
 #include <string.h>
+#include "pool.h"
 
 #define __block_size    1024 * 1024
 
 struct block_t {
 
     enum cmd_t {
-        keepalive, version, full, name, add, list, connect, unavailable, data, disconnect
+        keepalive, version, full, name, add, list, connect, unavailable, data, disconnect, abort
     } _cmd;
-    int _size;
+    int _size, _capacity;
+    unsigned int _stream;
     unsigned char *_data;
 
     block_t() {
-        _data = new unsigned char[__block_size];
+        _cmd = keepalive;
+        _size = _capacity = 0;
+        _stream = 0;
+        _data = NULL;
     }
 
     block_t(cmd_t cmd) {
         _cmd = cmd;
-        _size = 0;
-        _data = new unsigned char[__block_size];
+        _size = _capacity = 0;
+        _stream = 0;
+        _data = NULL;
     }
 
     block_t(cmd_t cmd, int size) {
         _cmd = cmd;
         _size = size;
-        _data = new unsigned char[__block_size];
+        _stream = 0;
+        _data = Pool::acquire(size, _capacity);
     }
 
     block_t(cmd_t cmd, const void *data, int size) {
         _cmd = cmd;
         _size = size;
-        _data = new unsigned char[__block_size];
+        _stream = 0;
+        _data = Pool::acquire(size, _capacity);
         memcpy(_data, data, size);
     }
 
-    ~block_t() {
-        delete[] _data;
+    block_t(const block_t &block) {
+        _cmd = block._cmd;
+        _size = block._size;
+        _stream = block._stream;
+        _data = Pool::acquire(block._size, _capacity);
+        memcpy(_data, block._data, block._size);
     }
 
-    block_t &operator=(const block_t & block) {
+    block_t(block_t &&block) {
         _cmd = block._cmd;
         _size = block._size;
-        memcpy(_data, block._data, block._size);
+        _capacity = block._capacity;
+        _stream = block._stream;
+        _data = block._data;
+        block._size = block._capacity = 0;
+        block._data = NULL;
+    }
+
+    ~block_t() {
+        Pool::release(_data, _capacity);
+    }
+
+    block_t &operator=(const block_t &block) {
+        if (this != &block) {
+            _cmd = block._cmd;
+            _size = block._size;
+            _stream = block._stream;
+            reserve(block._size);
+            memcpy(_data, block._data, block._size);
+        }
         return *this;
     }
 
+    block_t &operator=(block_t &&block) {
+        swap(block);
+        return *this;
+    }
+
+    // Makes room for size bytes of payload, contents are not preserved
+    void reserve(int size) {
+        if (!_data || size > _capacity) {
+            Pool::release(_data, _capacity);
+            _data = Pool::acquire(size, _capacity);
+        }
+    }
+
+    void swap(block_t &block) {
+
+        cmd_t cmd = _cmd;
+        int size = _size, capacity = _capacity;
+        unsigned int stream = _stream;
+        unsigned char *data = _data;
+
+        _cmd = block._cmd;
+        _size = block._size;
+        _capacity = block._capacity;
+        _stream = block._stream;
+        _data = block._data;
+        block._cmd = cmd;
+        block._size = size;
+        block._capacity = capacity;
+        block._stream = stream;
+        block._data = data;
+    }
+
 };
 
 #endif
@@ -0,0 +1,133 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "chunker.h"
+
+uint64_t Chunker::_gear[256];
+bool Chunker::_initialized = false;
+
+int Chunker::cut(const unsigned char *data, int size) {
+
+    int normal = __chunk_average, i = __chunk_min;
+    uint64_t hash = 0;
+
+    if (!_initialized)
+        initialize();
+    if (size <= __chunk_min)
+        return size;
+    if (size > __chunk_max)
+        size = __chunk_max;
+    if (normal > size)
+        normal = size;
+    for (; i < normal; i++) {
+        hash = (hash << 1) + _gear[data[i]];
+        if (!(hash & __chunk_mask_small))
+            return i + 1;
+    }
+    for (; i < size; i++) {
+        hash = (hash << 1) + _gear[data[i]];
+        if (!(hash & __chunk_mask_large))
+            return i + 1;
+    }
+    return size;
+}
+
+void Chunker::index(const std::string &path, std::vector<chunk_t> &chunks) {
+
+    int size;
+    long offset = 0;
+    std::string line, hex;
+    std::vector<unsigned char> buffer(4 * __chunk_max);
+    std::ifstream index((path + __index_suffix).c_str()), file;
+    struct stat info;
+    chunk_t chunk;
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    size_t used = 0, pos = 0;
+
+    chunks.clear();
+    if (stat(path.c_str(), &info))
+        return;
+    if (index && std::getline(index, line) && line == get_stamp(info)) {
+        while (index >> hex >> chunk.size) {
+            chunk.offset = offset;
+            chunk.hash.clear();
+            for (size_t i = 0; i + 1 < hex.size(); i += 2)
+                chunk.hash += (char) strtol(hex.substr(i, 2).c_str(), NULL, 16);
+            chunks.push_back(chunk);
+            offset += chunk.size;
+        }
+        if (offset == info.st_size)
+            return;
+        chunks.clear();
+    }
+    file.open(path.c_str(), std::ifstream::binary);
+    while (true) {
+        if (used - pos < __chunk_max && file) {
+            used -= pos;
+            memmove(&buffer[0], &buffer[pos], used);
+            pos = 0;
+            file.read((char *) &buffer[used], buffer.size() - used);
+            used += file.gcount();
+        }
+        if (pos == used)
+            break;
+        size = cut(&buffer[pos], used - pos);
+        SHA256(&buffer[pos], size, digest);
+        chunk.offset = offset;
+        chunk.size = size;
+        chunk.hash = std::string((char *) digest, sizeof digest);
+        chunks.push_back(chunk);
+        offset += size;
+        pos += size;
+    }
+    save_index(path, chunks);
+}
+
+void Chunker::save_index(const std::string &path, const std::vector<chunk_t> &chunks) {
+
+    const char digits[] = "0123456789abcdef";
+    std::ofstream index((path + __index_suffix).c_str(), std::ofstream::trunc);
+    struct stat info;
+
+    if (stat(path.c_str(), &info))
+        return;
+    index << get_stamp(info) << "\n";
+    for (size_t i = 0; i < chunks.size(); i++) {
+        for (size_t j = 0; j < chunks[i].hash.size(); j++)
+            index << digits[(unsigned char) chunks[i].hash[j] >> 4] << digits[(unsigned char) chunks[i].hash[j] & 0xf];
+        index << " " << chunks[i].size << "\n";
+    }
+}
+
+std::string Chunker::get_stamp(const struct stat &info) {
+
+    std::stringstream stream;
+
+    stream << "index " << info.st_size << " " << info.st_ino << " " << info.st_mtim.tv_sec << "." << info.st_mtim.tv_nsec << " " << info.st_ctim.tv_sec << "." << info.st_ctim.tv_nsec;
+    return stream.str();
+}
+
+void Chunker::initialize() {
+
+    uint64_t state = 0x5afec4a7ULL, value;
+
+    for (int i = 0; i < 256; i++) {
+        value = (state += 0x9e3779b97f4a7c15ULL);
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+        _gear[i] = value ^ (value >> 31);
+    }
+    _initialized = true;
+}
@@ -0,0 +1,68 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef chunker_h
+#define	chunker_h
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+
+#define __chunk_min     16 * 1024
+#define __chunk_average 64 * 1024
+#define __chunk_max     256 * 1024
+#define __chunk_mask_small  0xffffc00000000000ULL
+#define __chunk_mask_large  0xfffc000000000000ULL
+#define __index_suffix  ".safechat-index"
+
+/*
+  Content defined chunking with a gear rolling hash and FastCDC style
+  normalization: a stricter mask before the average size and a looser one
+  after it keeps chunk sizes close to the average. Boundaries depend only
+  on nearby content, so an edit only changes the chunks around it. Indexes
+  of received files are cached in a sidecar keyed by size, inode and the
+  nanosecond modification and change times, so any local edit, even one
+  that puts the old modification time back, forces a rebuild.
+ */
+class Chunker {
+public:
+
+    struct chunk_t {
+        long offset;
+        int size;
+        std::string hash;
+    };
+
+    static int cut(const unsigned char *data, int size);
+    static void index(const std::string &path, std::vector<chunk_t> &chunks);
+    static void save_index(const std::string &path, const std::vector<chunk_t> &chunks);
+
+private:
+
+    static uint64_t _gear[256];
+    static bool _initialized;
+
+    static void initialize();
+    static std::string get_stamp(const struct stat &info);
+
+};
+
+#endif
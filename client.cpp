@@ -20,10 +20,38 @@ Client::Client(int argc, char **argv) {
     std::string string;
     std::ifstream config_file;
 
-    _network_data = _terminal_data = false;
+    _verbose = false;
+    _blocked = _handshaking = _frame_wanted = _disconnected = false;
+    _waiting = 0;
+    _events = 0;
+    _frame_pending = _input_closed = _socket_readable = _direct_read = false;
+    _frame_received = _recv_start = _recv_end = 0;
+    _recv_buffer = new unsigned char[__recv_buffer_size];
+    _socket = _control_fd = _epoll_fd = _wake_fd = _timer_fd = _batch_fd = -1;
+    _input_fd = STDIN_FILENO;
+    _headless = false;
+    _batch_window = _server_flags = 0;
+    _compact = _compress = _resume = _delta = _streams = _folders = _verify = false;
+    _preallocate = true;
+    _file_io = __storage_buffered;
+    _file_workers = __file_workers;
+    _ticket_ttl = __ticket_ttl;
+    _frame_flags = 0;
+    _frame_stream = _next_stream = _peer_stream = 0;
+    _connections = 0;
+    _next_lane = 0;
+    _event_loop = pthread_self();
+    _group = __group_ffdhe2048;
+    _cipher = __cipher_auto;
+    _queue_depth = 4;
+    _crypto_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    _raw_blocks = 0;
+    _parallel = false;
+    _features = __feature_dh_group | __feature_x25519 | __feature_parallel | __feature_compact | __feature_compress | __feature_resume | __feature_delta | __feature_streams | __feature_stripes | __feature_folders | __feature_verify | __feature_tickets;
     time(&_time);
-    pthread_cond_init(&_cond, NULL);
-    pthread_mutex_init(&_mutex, NULL);
+    pthread_mutex_init(&_send_mutex, NULL);
+    pthread_mutex_init(&_seal_mutex, NULL);
+    pthread_mutex_init(&_transfer_mutex, NULL);
     _config_path = std::string(getenv("HOME")) + "/.safechat";
     try {
         config_file.open(_config_path.c_str());
@@ -38,6 +66,52 @@ Client::Client(int argc, char **argv) {
                 _port = atoi(string.substr(5).c_str());
             else if (string.substr(0, 10) == "file_path=")
                 _file_path = string.substr(10);
+            else if (string.substr(0, 9) == "dh_group=")
+                _group = Crypto::group_id(string.substr(9));
+            else if (string.substr(0, 13) == "key_exchange=") {
+                if (string.substr(13) == "dh")
+                    _features &= ~__feature_x25519;
+                else if (string.substr(13) != "x25519")
+                    throw std::runtime_error("unknown key exchange " + string.substr(13));
+            } else if (string.substr(0, 7) == "cipher=")
+                _cipher = Crypto::cipher_id(string.substr(7));
+            else if (string.substr(0, 12) == "queue_depth=")
+                _queue_depth = atoi(string.substr(12).c_str());
+            else if (string.substr(0, 15) == "crypto_threads=")
+                _crypto_threads = atoi(string.substr(15).c_str());
+            else if (string.substr(0, 13) == "batch_window=")
+                _batch_window = atoi(string.substr(13).c_str());
+            else if (string.substr(0, 12) == "compression=") {
+                if (string.substr(12) == "off")
+                    _features &= ~__feature_compress;
+                else if (string.substr(12) != "on")
+                    throw std::runtime_error("unknown compression setting " + string.substr(12));
+            } else if (string.substr(0, 7) == "verify=") {
+                if (string.substr(7) == "off")
+                    _features &= ~__feature_verify;
+                else if (string.substr(7) != "on")
+                    throw std::runtime_error("unknown verify setting " + string.substr(7));
+            } else if (string.substr(0, 8) == "file_io=")
+                _file_io = Storage::mode_id(string.substr(8));
+            else if (string.substr(0, 12) == "preallocate=") {
+                if (string.substr(12) == "off")
+                    _preallocate = false;
+                else if (string.substr(12) != "on")
+                    throw std::runtime_error("unknown preallocate setting " + string.substr(12));
+            } else if (string.substr(0, 13) == "file_workers=")
+                _file_workers = atoi(string.substr(13).c_str());
+            else if (string.substr(0, 11) == "ticket_ttl=") {
+                _ticket_ttl = atoi(string.substr(11).c_str());
+                if (_ticket_ttl <= 0)
+                    _features &= ~__feature_tickets;
+            } else if (string.substr(0, 12) == "connections=")
+                _connections = string.substr(12) == "auto" ? 0 : atoi(string.substr(12).c_str());
+            else if (string.substr(0, 8) == "metrics=") {
+                if (string.substr(8) == "on")
+                    Metrics::enable(true);
+                else if (string.substr(8) != "off")
+                    throw std::runtime_error("unknown metrics setting " + string.substr(8));
+            }
         config_file.close();
     } catch (const std::exception &exception) {
         std::cerr << "Error: " << exception.what() << ".\n";
@@ -53,6 +127,12 @@ Client::Client(int argc, char **argv) {
                 _port = atoi(argv[++i]);
             else if (string == "-f" && i + 1 < argc)
                 _file_path = argv[++i];
+            else if (string == "-b" && i + 1 < argc)
+                _command_path = argv[++i];
+            else if (string == "-c" && i + 1 < argc)
+                _control_path = argv[++i];
+            else if (string == "-v")
+                _verbose = true;
             else
                 throw std::runtime_error("unknown argument " + std::string(argv[i]));
         }
@@ -64,67 +144,141 @@ Client::Client(int argc, char **argv) {
             throw std::runtime_error("invalid port number");
         if (_file_path.size() < 1)
             throw std::runtime_error("file transfer path required");
+        if (_queue_depth < 1)
+            throw std::runtime_error("invalid queue depth");
+        if (_crypto_threads < 1)
+            throw std::runtime_error("invalid number of crypto threads");
+        if (_batch_window < 0 || _batch_window >= 1000000)
+            throw std::runtime_error("invalid batch window");
+        if (_connections < 0 || _connections > __stripe_max)
+            throw std::runtime_error("invalid number of connections");
     } catch (const std::exception &exception) {
-        std::cout << "SafeChat (version " << std::fixed << std::setprecision(1) << __version << ") - (c) 2013 Nicholas Pitt\nhttps://www.xphysics.net/\n\n    -n <name> Specifies the name forwarded to the SafeChat server (use quotes)\n    -s <serv> Specifies the DNS name or IP address of a SafeChat server\n    -p <port> Specifies the port the SafeChat server is running on\n    -f <path> Specifies the file transfer path (use quotes)\n" << std::endl;
+        std::cout << "SafeChat (version " << std::fixed << std::setprecision(1) << __version << ") - (c) 2013 Nicholas Pitt\nhttps://www.xphysics.net/\n\n    -n <name> Specifies the name forwarded to the SafeChat server (use quotes)\n    -s <serv> Specifies the DNS name or IP address of a SafeChat server\n    -p <port> Specifies the port the SafeChat server is running on\n    -f <path> Specifies the file transfer path (use quotes)\n    -b <file> Runs the commands in a file instead of prompting (use quotes)\n    -c <path> Accepts commands on a local Unix socket instead of prompting\n    -v        Prints block buffer pool statistics on exit\n" << std::endl;
         std::cerr << "Error: " << exception.what() << ".\n";
         exit(EXIT_FAILURE);
     }
+    _headless = !_command_path.empty() || !_control_path.empty();
+    if (_headless)
+        _input_fd = -1;
     _file_path = trim_path(_file_path);
     if (_file_path[_file_path.size() - 1] != '/')
         _file_path += "/";
+    Crypto::load_groups(_config_path + "_dh");
+    if (_cipher == __cipher_aes_gcm)
+        _features |= __feature_aes_gcm;
+    else if (_cipher == __cipher_chacha20)
+        _features |= __feature_chacha20;
+    else if (_cipher == __cipher_auto) {
+        _features |= __feature_chacha20;
+#if defined(__x86_64__) || defined(__i386__)
+        if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul"))
+#endif
+            _features |= __feature_aes_gcm;
+    }
 }
 
 Client::~Client() {
 
     std::ofstream config_file;
+    iovec iov;
 
-    if (!pthread_equal(pthread_self(), _terminal_listener))
-        pthread_kill(_terminal_listener, SIGTERM);
-    if (!pthread_equal(pthread_self(), _network_listener))
-        pthread_kill(_network_listener, SIGTERM);
-    pthread_kill(_keepalive_sender, SIGTERM);
+    if (!pthread_equal(pthread_self(), _event_loop))
+        pthread_kill(_event_loop, SIGTERM);
+    if (!_batch.empty() && !pthread_mutex_trylock(&_send_mutex)) {
+        iov.iov_base = (void *) _batch.data();
+        iov.iov_len = _batch.size();
+        write_all(_socket, &iov, 1);
+        pthread_mutex_unlock(&_send_mutex);
+    }
     close(_socket);
-    pthread_mutex_unlock(&_mutex);
-    pthread_cond_destroy(&_cond);
-    pthread_mutex_destroy(&_mutex);
+    if (_control_fd >= 0) {
+        close(_control_fd);
+        unlink(_control_path.c_str());
+    }
+    for (size_t i = 0; i < _lanes.size(); i++)
+        shutdown(_lanes[i]->_socket, SHUT_RDWR);
+    close(_epoll_fd);
+    close(_wake_fd);
+    close(_timer_fd);
+    close(_batch_fd);
+    delete[] _recv_buffer;
+    if (Metrics::is_enabled())
+        unlink((_config_path + "_metrics").c_str());
     try {
         config_file.open(_config_path.c_str());
         if (!config_file)
             throw std::runtime_error("can't write configuration file");
-        config_file << "Configuration file for SafeChat\n\nlocal_name=" << _name << "\nserver=" << _server << "\nport=" << _port << "\nfile_path=" << _file_path;
+        config_file << "Configuration file for SafeChat\n\nlocal_name=" << _name << "\nserver=" << _server << "\nport=" << _port << "\nfile_path=" << _file_path << "\ndh_group=" << Crypto::group_name(_group) << "\nkey_exchange=" << (_features & __feature_x25519 ? "x25519" : "dh") << "\ncipher=" << Crypto::cipher_name(_cipher) << "\nqueue_depth=" << _queue_depth << "\ncrypto_threads=" << _crypto_threads << "\nbatch_window=" << _batch_window << "\ncompression=" << (_features & __feature_compress ? "on" : "off") << "\nverify=" << (_features & __feature_verify ? "on" : "off") << "\nfile_io=" << Storage::mode_name(_file_io) << "\npreallocate=" << (_preallocate ? "on" : "off") << "\nfile_workers=" << _file_workers << "\nticket_ttl=" << (_features & __feature_tickets ? _ticket_ttl : 0) << "\nconnections=" << (_connections ? std::to_string(_connections) : "auto") << "\nmetrics=" << (Metrics::is_enabled() ? "on" : "off");
         config_file.close();
     } catch (const std::exception &exception) {
         std::cerr << "\nError: " << exception.what() << ".";
     }
+    if (_verbose)
+        std::cout << "\nBlock pool: " << Pool::hits() << " hits, " << Pool::misses() << " misses." << std::flush;
     std::cout << std::endl;
 }
 
 void Client::start() {
 
-    int id, hosts_size, choice;
-    float version = __version;
+    int choice, fds[5];
     std::string string;
-    sockaddr_in addr;
-    hostent *host;
+    std::ifstream command_file;
+    itimerspec timer;
+    epoll_event event;
+    sockaddr_un addr;
     peers_t peers;
     block_t block;
 
     try {
-        _socket = socket(AF_INET, SOCK_STREAM, 0);
-        host = gethostbyname(_server.c_str());
-        if (!host)
-            throw std::runtime_error("can't resolve server name");
-        addr.sin_family = AF_INET;
-        memcpy(&addr.sin_addr.s_addr, host->h_addr_list[0], host->h_length);
-        addr.sin_port = htons(_port);
-        if (connect(_socket, (sockaddr *) & addr, sizeof addr))
-            throw std::runtime_error("can't connect to server");
-        pthread_create(&_terminal_listener, NULL, &Client::terminal_listener, this);
-        pthread_create(&_network_listener, NULL, &Client::network_listener, this);
-        pthread_create(&_keepalive_sender, NULL, &Client::keepalive_sender, this);
+        _socket = dial();
+        if (Metrics::is_enabled() && !Metrics::serve(_config_path + "_metrics"))
+            throw std::runtime_error("can't serve metrics");
+        _epoll_fd = epoll_create1(0);
+        _wake_fd = eventfd(0, EFD_NONBLOCK);
+        _timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        timer.it_value.tv_sec = timer.it_interval.tv_sec = __timeout / 3;
+        timer.it_value.tv_nsec = timer.it_interval.tv_nsec = 0;
+        timerfd_settime(_timer_fd, 0, &timer, NULL);
+        _batch_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK);
+        if (!_command_path.empty()) {
+            command_file.open(_command_path.c_str());
+            if (!command_file)
+                throw std::runtime_error("can't read command file");
+            std::getline(command_file, _input, '\0');
+            _input += "\n";
+        }
+        if (!_control_path.empty()) {
+            _control_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            memset(&addr, 0, sizeof addr);
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, _control_path.c_str(), sizeof addr.sun_path - 1);
+            unlink(_control_path.c_str());
+            if (_control_fd < 0 || bind(_control_fd, (sockaddr *) & addr, sizeof addr) || listen(_control_fd, 1))
+                throw std::runtime_error("can't open control socket");
+        }
+        if (!_headless)
+            fcntl(STDIN_FILENO, F_SETFL, fcntl(STDIN_FILENO, F_GETFL) | O_NONBLOCK);
+        fds[0] = _headless ? _control_fd : STDIN_FILENO;
+        fds[1] = _socket;
+        fds[2] = _wake_fd;
+        fds[3] = _timer_fd;
+        fds[4] = _batch_fd;
+        for (int i = 0; i < 5; i++) {
+            if (fds[i] < 0)
+                continue;
+            event.events = EPOLLIN;
+            event.data.fd = fds[i];
+            if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fds[i], &event))
+                throw std::runtime_error("can't watch input");
+        }
+        _network_queue = new Queue(_queue_depth);
+        _terminal_queue = new Queue(__terminal_depth);
+        pthread_create(&_event_loop, NULL, &Client::event_loop, this);
         recv_block(block);
         if (*(int *) block._data != (int) __version)
             throw std::runtime_error("incompatible server version");
+        if (block._size >= (int) (2 * sizeof (int)))
+            _server_flags = *(int *) (block._data + sizeof (int));
         recv_block(block);
         if (*(bool *) block._data)
             throw std::runtime_error("server is full");
@@ -135,78 +289,40 @@ void Client::start() {
         exit(EXIT_FAILURE);
     }
     try {
-        while (true) {
-            do {
-                std::cout << "\nMain Menu\n\n    1) Start\n    2) Connect\n\nChoice: " << std::flush;
+        while (true)
+            if (_headless) {
                 get_string(string);
-            } while (string != "1" && string != "2");
-            if (string == "1") {
-                send_block(block_t(block_t::add));
-                std::cout << "\nWaiting for peer to connect..." << std::flush;
-                recv_block(block);
-                _peer_name = (char *) block._data;
-                std::cout << "\n\nConnected to " << _peer_name << "." << std::flush;
-                send_block(block_t(block_t::data, &version, sizeof version));
-                recv_block(block);
-                if (*(float *) block._data != (float) __version)
-                    throw std::runtime_error("incompatible peer version");
-                _crypto.get_prime(block);
-                send_block(block);
-                _crypto.get_public_key(block);
-                send_block(block);
-                recv_block(block);
-                _crypto.set_public_key(block);
-                _crypto.get_init_vector(block);
-                send_block(block);
-                _crypto.set_init_vector(block);
-                shell();
-            } else if (string == "2") {
-                while (true) {
-                    send_block(block_t(block_t::list));
-                    recv_block(block);
-                    hosts_size = *(int *) block._data;
-                    if (!hosts_size) {
-                        std::cout << "\nNo available peers." << std::endl;
-                        break;
-                    }
-                    peers.clear();
-                    for (int i = 0; i < hosts_size; i++) {
-                        recv_block(block);
-                        id = *(int *) block._data;
-                        recv_block(block);
-                        peers.push_back(std::make_pair(id, (char *) block._data));
+                if (string == "listen")
+                    wait_for_peer();
+                else if (string.substr(0, 8) == "connect ")
+                    find_peer(string.substr(8));
+                else
+                    run_command(string);
+            } else {
+                do {
+                    std::cout << "\nMain Menu\n\n    1) Start\n    2) Connect\n\nChoice: " << std::flush;
+                    get_string(string);
+                } while (string != "1" && string != "2");
+                if (string == "1")
+                    wait_for_peer();
+                else if (string == "2")
+                    while (true) {
+                        list_peers(peers);
+                        if (peers.empty()) {
+                            std::cout << "\nNo available peers." << std::endl;
+                            break;
+                        }
+                        do {
+                            std::cout << "\nPeers:\n" << std::endl;
+                            for (size_t i = 0; i < peers.size(); i++)
+                                std::cout << "    " << i + 1 << ") " << peers[i].second << std::endl;
+                            std::cout << "\nChoice: " << std::flush;
+                            get_string(string);
+                            choice = atoi(string.c_str()) - 1;
+                        } while (choice < 0 || choice >= (int) peers.size());
+                        connect_to_peer(peers[choice]);
                     }
-                    do {
-                        std::cout << "\nPeers:\n" << std::endl;
-                        for (int i = 0; i < hosts_size; i++)
-                            std::cout << "    " << i + 1 << ") " << peers[i].second << std::endl;
-                        std::cout << "\nChoice: " << std::flush;
-                        get_string(string);
-                        choice = atoi(string.c_str()) - 1;
-                    } while (choice < 0 || choice >= hosts_size);
-                    send_block(block_t(block_t::connect, &peers[choice].first, sizeof peers[choice].first));
-                    recv_block(block);
-                    if (block._cmd == block_t::connect) {
-                        _peer_name = (char *) block._data;
-                        std::cout << "\nConnected to " << _peer_name << "." << std::flush;
-                        send_block(block_t(block_t::data, &version, sizeof version));
-                        recv_block(block);
-                        if (*(float *) block._data != (float) __version)
-                            throw std::runtime_error("incompatible peer version");
-                        recv_block(block);
-                        _crypto.set_prime(block);
-                        _crypto.get_public_key(block);
-                        send_block(block);
-                        recv_block(block);
-                        _crypto.set_public_key(block);
-                        recv_block(block);
-                        _crypto.set_init_vector(block);
-                        shell();
-                    } else if (block._cmd == block_t::unavailable)
-                        std::cout << "\n" << peers[choice].second << " is unavailable." << std::endl;
-                }
             }
-        }
     } catch (const std::exception &exception) {
         std::cerr << "\nError: " << exception.what() << ".";
         this->~Client();
@@ -214,129 +330,324 @@ void Client::start() {
     }
 }
 
+void Client::wait_for_peer() {
+
+    block_t block;
+
+    send_block(block_t(block_t::add));
+    std::cout << "\nWaiting for peer to connect..." << std::flush;
+    recv_block(block);
+    _peer_name = (char *) block._data;
+    std::cout << "\n\nConnected to " << _peer_name << "." << std::flush;
+    handshake(true);
+    shell();
+}
+
+void Client::list_peers(peers_t &peers) {
+
+    int id, hosts_size;
+    block_t block;
+
+    send_block(block_t(block_t::list));
+    recv_block(block);
+    hosts_size = *(int *) block._data;
+    peers.clear();
+    for (int i = 0; i < hosts_size; i++) {
+        recv_block(block);
+        id = *(int *) block._data;
+        recv_block(block);
+        if (block._data[0] != '#')
+            peers.push_back(std::make_pair(id, (char *) block._data));
+    }
+}
+
+void Client::connect_to_peer(const std::pair<int, std::string> &peer) {
+
+    block_t block;
+
+    send_block(block_t(block_t::connect, &peer.first, sizeof peer.first));
+    recv_block(block);
+    if (block._cmd == block_t::connect) {
+        _peer_name = (char *) block._data;
+        std::cout << "\nConnected to " << _peer_name << "." << std::flush;
+        handshake(false);
+        shell();
+    } else if (block._cmd == block_t::unavailable)
+        std::cout << "\n" << peer.second << " is unavailable." << std::endl;
+}
+
+void Client::find_peer(const std::string &name) {
+
+    bool waiting = false;
+    peers_t peers;
+
+    while (true) {
+        list_peers(peers);
+        for (size_t i = 0; i < peers.size(); i++)
+            if (peers[i].second == name)
+                connect_to_peer(peers[i]);
+        if (!waiting)
+            std::cout << "\nWaiting for " << name << " to start..." << std::flush;
+        waiting = true;
+        sleep(1);
+    }
+}
+
+int Client::dial() {
+
+    int fd, value = 1;
+    sockaddr_in addr;
+    hostent *host;
+
+    host = gethostbyname(_server.c_str());
+    if (!host)
+        throw std::runtime_error("can't resolve server name");
+    addr.sin_family = AF_INET;
+    memcpy(&addr.sin_addr.s_addr, host->h_addr_list[0], host->h_length);
+    addr.sin_port = htons(_port);
+    fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (connect(fd, (sockaddr *) & addr, sizeof addr)) {
+        close(fd);
+        throw std::runtime_error("can't connect to server");
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &value, sizeof value);
+    return fd;
+}
+
+void Client::handshake(bool initiator) {
+
+    bool resumed = false;
+    int features = _features, offset = sizeof(float) + sizeof features;
+    float version = __version;
+    std::string secret, nonces;
+    timespec start_time, end_time;
+    block_t block, hello;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    // Until the session key is installed the event loop hands over one frame
+    // per recv_block call and keeps off the terminal, so it never decrypts a
+    // frame early or touches _crypto while the keys are being set
+    _handshaking = true;
+    _tickets.load(_config_path + "_tickets");
+    if (features & __feature_tickets)
+        _tickets.find(_peer_name, secret);
+    hello = block_t(block_t::data, offset + __hello_nonce_size + (secret.empty() ? 0 : SHA256_DIGEST_LENGTH));
+    memcpy(hello._data, &version, sizeof version);
+    memcpy(hello._data + sizeof version, &features, sizeof features);
+    RAND_bytes(hello._data + offset, __hello_nonce_size);
+    if (!secret.empty())
+        memcpy(hello._data + offset + __hello_nonce_size, Crypto::bind_ticket(secret, hello._data + offset, __hello_nonce_size).data(), SHA256_DIGEST_LENGTH);
+    send_block(hello);
+    recv_block(block);
+    if (*(float *) block._data != (float) __version)
+        throw std::runtime_error("incompatible peer version");
+    if (block._size >= offset)
+        features &= *(int *) (block._data + sizeof version);
+    else
+        features = 0;
+    if (features & __feature_tickets && !secret.empty() && block._size == offset + __hello_nonce_size + SHA256_DIGEST_LENGTH)
+        resumed = Crypto::bind_ticket(secret, block._data + offset, __hello_nonce_size) ==
+                std::string((char *) block._data + offset + __hello_nonce_size, SHA256_DIGEST_LENGTH);
+    if (features & __feature_aes_gcm)
+        _crypto.set_cipher(__cipher_aes_gcm, initiator);
+    else if (features & __feature_chacha20)
+        _crypto.set_cipher(__cipher_chacha20, initiator);
+    else
+        _crypto.set_cipher(__cipher_cbc, initiator);
+    if (resumed) {
+        _tickets.remove(_peer_name);
+        nonces = std::string((char *) (initiator ? hello : block)._data + offset, __hello_nonce_size) +
+                std::string((char *) (initiator ? block : hello)._data + offset, __hello_nonce_size);
+        _crypto.resume_session(secret, nonces);
+        if (initiator)
+            send_block(block_t(block_t::data, block._data + offset, __hello_nonce_size));
+        else {
+            recv_block(block);
+            if (block._size != __hello_nonce_size || memcmp(block._data, hello._data + offset, __hello_nonce_size))
+                throw std::runtime_error("can't resume session");
+        }
+    } else if (features & __feature_x25519) {
+        _crypto.get_ecdh_key(block);
+        send_block(block);
+        recv_block(block);
+        _crypto.set_ecdh_key(block);
+        if (initiator) {
+            _crypto.get_init_vector(block);
+            _crypto.set_init_vector(block);
+            if (!write_block(block, 0))
+                throw std::runtime_error("can't write to socket");
+        } else {
+            recv_block(block);
+            _crypto.set_init_vector(block);
+        }
+    } else if (initiator) {
+        _crypto.get_group(block, _group);
+        send_block(block);
+        _crypto.get_public_key(block);
+        send_block(block);
+        recv_block(block);
+        _crypto.set_public_key(block);
+        _crypto.get_init_vector(block);
+        _crypto.set_init_vector(block);
+        if (!write_block(block, 0))
+            throw std::runtime_error("can't write to socket");
+    } else {
+        recv_block(block);
+        _crypto.set_group(block);
+        _crypto.get_public_key(block);
+        send_block(block);
+        recv_block(block);
+        _crypto.set_public_key(block);
+        recv_block(block);
+        _crypto.set_init_vector(block);
+    }
+    _handshaking = false;
+    wake();
+    _parallel = features & __feature_parallel && _crypto.is_parallel();
+    _compact = features & __feature_compact && _server_flags & __server_transparent;
+    _resume = features & __feature_resume;
+    _delta = features & __feature_delta;
+    _streams = features & __feature_streams && _compact && _parallel;
+    _folders = features & __feature_folders;
+    _verify = features & __feature_verify;
+    _next_stream = initiator ? 1 : 2;
+    _peer_stream = initiator ? 2 : 1;
+    _skipped_streams.clear();
+    _compress = features & __feature_compress;
+    if (features & __feature_stripes && _streams)
+        open_lanes(initiator);
+    if (features & __feature_tickets)
+        _tickets.store(_peer_name, _crypto.get_ticket(), time(NULL) + _ticket_ttl);
+    OPENSSL_cleanse(&secret[0], secret.size());
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    if (_verbose)
+        std::cout << "\nHandshake took " << std::fixed << std::setprecision(1) << (end_time.tv_sec - start_time.tv_sec) * 1e3 + (end_time.tv_nsec - start_time.tv_nsec) / 1e6 << " ms" << (resumed ? " (resumed)." : ".") << std::flush;
+}
+
+void Client::open_lanes(bool initiator) {
+
+    int count, id, hosts_size, choice;
+    unsigned char token[2 * __lane_key_size];
+    std::string name;
+    lane_t *lane;
+    block_t block;
+
+    count = _connections ? _connections : probe_connections();
+    send_block(block_t(block_t::data, &count, sizeof count));
+    recv_block(block);
+    count = std::min(count, *(int *) block._data);
+    if (count < 2)
+        return;
+    if (initiator) {
+        RAND_bytes(token, sizeof token);
+        send_block(block_t(block_t::data, token, sizeof token));
+    } else {
+        recv_block(block);
+        if (block._size != sizeof token)
+            throw std::runtime_error("malformed block received");
+        memcpy(token, block._data, sizeof token);
+        recv_block(block);
+    }
+    name = "#" + Manifest::to_hex(std::string((char *) token, __lane_key_size));
+    for (int i = 1; i < count; i++) {
+        lane = new lane_t;
+        lane->_client = this;
+        lane->_socket = dial();
+        lane->_start = lane->_end = 0;
+        pthread_mutex_init(&lane->_mutex, NULL);
+        _lanes.push_back(lane);
+        lane_recv(lane->_socket, block);
+        lane_recv(lane->_socket, block);
+        if (*(bool *) block._data)
+            throw std::runtime_error("server is full");
+        lane_send(lane->_socket, block_t(block_t::name, name.c_str(), name.size() + 1));
+        if (initiator) {
+            lane_send(lane->_socket, block_t(block_t::add));
+            continue;
+        }
+        lane_send(lane->_socket, block_t(block_t::list));
+        lane_recv(lane->_socket, block);
+        hosts_size = *(int *) block._data;
+        id = -1;
+        for (int j = 0; j < hosts_size; j++) {
+            lane_recv(lane->_socket, block);
+            choice = *(int *) block._data;
+            lane_recv(lane->_socket, block);
+            if (id < 0 && name == (char *) block._data)
+                id = choice;
+        }
+        if (id < 0)
+            throw std::runtime_error("can't open connection");
+        lane_send(lane->_socket, block_t(block_t::connect, &id, sizeof id));
+        lane_recv(lane->_socket, block);
+        if (block._cmd != block_t::connect)
+            throw std::runtime_error("can't open connection");
+        lane_send(lane->_socket, block_t(block_t::data, token + __lane_key_size, __lane_key_size));
+    }
+    if (initiator) {
+        send_block(block_t(block_t::data, &count, sizeof count));
+        for (size_t i = 0; i < _lanes.size(); i++) {
+            lane_recv(_lanes[i]->_socket, block);
+            lane_recv(_lanes[i]->_socket, block);
+            if (block._size != __lane_key_size || CRYPTO_memcmp(block._data, token + __lane_key_size, __lane_key_size))
+                throw std::runtime_error("can't authenticate connection");
+        }
+    }
+    for (size_t i = 0; i < _lanes.size(); i++) {
+        pthread_create(&_lanes[i]->_reader, NULL, &Client::lane_reader, _lanes[i]);
+        pthread_detach(_lanes[i]->_reader);
+    }
+    std::cout << "\nStriping over " << count << " connections." << std::flush;
+}
+
+int Client::probe_connections() {
+
+    tcp_info info;
+    socklen_t size = sizeof info;
+
+    if (getsockopt(_socket, IPPROTO_TCP, TCP_INFO, &info, &size))
+        return 1;
+    return std::min(1 + (int) (info.tcpi_rtt / __stripe_rtt), __stripe_max);
+}
+
 void Client::shell() {
 
-    bool accept;
-    long file_size, bytes_sent, bytes_remaining, rate, time_elapsed;
-    std::string string, file_path, file_name;
-    std::ofstream out_file;
-    std::ifstream in_file;
-    time_t start_time;
+    std::string line, file_path;
+    transfer_t *transfer;
     block_t block;
 
-    std::cout << "\n\nCommands:\n\n    <path> - Transfer file\n    <entr> - Disconnect\n" << std::endl;
+    if (!_headless)
+        std::cout << "\n\nCommands:\n\n    <path> - Transfer file or folder\n    <entr> - Disconnect\n" << std::endl;
+    else
+        std::cout << std::endl;
     while (true) {
         try {
-            std::cout << _name << ": " << std::flush;
-            pthread_mutex_lock(&_mutex);
-            while (!_network_data && !_terminal_data)
-                pthread_cond_wait(&_cond, &_mutex);
-            if (_network_data) {
-                if (_block._data[0] == '/') {
-                    file_name = (char *) _block._data;
-                    _network_data = false;
-                    pthread_cond_signal(&_cond);
-                    pthread_mutex_unlock(&_mutex);
-                    file_name = file_name.substr(1);
-                    recv_block(block);
-                    file_size = *(long *) block._data;
-                    do {
-                        std::cout << "\r" << std::string(80, ' ') << "\rAccept transfer of " << file_name << " (" << format_size(file_size) << ")? (y/n) " << std::flush;
-                        get_string(string);
-                    } while (string != "y" && string != "n");
-                    if (string == "y") {
-                        file_path = _file_path + file_name;
-                        out_file.open(file_path.c_str(), std::ofstream::binary);
-                        if (!out_file) {
-                            accept = false;
-                            send_block(block_t(block_t::data, &accept, sizeof accept));
-                            throw std::runtime_error("can't write file");
-                        }
-                        accept = true;
-                        send_block(block_t(block_t::data, &accept, sizeof accept));
-                        bytes_sent = 0;
-                        bytes_remaining = file_size;
-                        time(&start_time);
-                        std::cout << "\r" << std::string(80, ' ') << "\rReceiving " << file_name << "..." << std::flush;
-                        do {
-                            recv_block(block);
-                            out_file.write((char *) block._data, block._size);
-                            bytes_sent += block._size;
-                            bytes_remaining -= block._size;
-                            time_elapsed = difftime(time(NULL), start_time);
-                            std::cout << "\r" << std::string(80, ' ') << "\rReceiving " << file_name << "... " << std::fixed << std::setprecision(0) << (double) bytes_sent / file_size * 100 << "%" << std::flush;
-                            if (time_elapsed) {
-                                rate = bytes_sent / time_elapsed;
-                                std::cout << " (" << format_time(bytes_remaining / rate) << " at " << format_size(rate) << "/s)" << std::flush;
-                            }
-                        } while (bytes_sent < file_size);
-                        std::cout << std::endl;
-                        out_file.close();
-                    } else if (string == "n") {
-                        accept = false;
-                        send_block(block_t(block_t::data, &accept, sizeof accept));
-                    }
-                } else {
-                    std::cout << "\r" << _peer_name << ": " << _block._data << std::endl;
-                    _network_data = false;
-                    pthread_cond_signal(&_cond);
-                    pthread_mutex_unlock(&_mutex);
-                }
-            } else if (_terminal_data) {
-                file_path = trim_path(_string);
-                if (file_path[0] == '/') {
-                    _terminal_data = false;
-                    pthread_cond_signal(&_cond);
-                    pthread_mutex_unlock(&_mutex);
-                    in_file.open(file_path.c_str(), std::ifstream::binary);
-                    if (!in_file)
-                        throw std::runtime_error("can't read file");
-                    file_name = file_path.substr(file_path.rfind("/"));
-                    send_block(block_t(block_t::data, file_name.c_str(), file_name.size() + 1));
-                    file_name = file_name.substr(1);
-                    in_file.seekg(0, std::ifstream::end);
-                    file_size = in_file.tellg();
-                    in_file.seekg(0, std::ifstream::beg);
-                    send_block(block_t(block_t::data, &file_size, sizeof file_size));
-                    std::cout << "Waiting for " << _peer_name << " to accept the file transfer..." << std::flush;
-                    recv_block(block);
-                    accept = *(bool *) block._data;
-                    if (accept) {
-                        bytes_sent = 0;
-                        bytes_remaining = file_size;
-                        time(&start_time);
-                        std::cout << "\nSending " << file_name << "..." << std::flush;
-                        do {
-                            if (bytes_remaining > __data_size)
-                                block._size = __data_size;
-                            else
-                                block._size = bytes_remaining;
-                            block = block_t(block_t::data, block._size);
-                            in_file.read((char *) block._data, block._size);
-                            send_block(block);
-                            bytes_sent += block._size;
-                            bytes_remaining -= block._size;
-                            time_elapsed = difftime(time(NULL), start_time);
-                            std::cout << "\r" << std::string(80, ' ') << "\rSending " << file_name << "... " << std::fixed << std::setprecision(0) << (double) bytes_sent / file_size * 100 << "%" << std::flush;
-                            if (time_elapsed) {
-                                rate = bytes_sent / time_elapsed;
-                                std::cout << " (" << format_time(bytes_remaining / rate) << " at " << format_size(rate) << "/s)" << std::flush;
-                            }
-                        } while (bytes_remaining);
-                        std::cout << "\n" << std::flush;
-                    } else
-                        std::cout << "\n" << _peer_name << " declined the file transfer." << std::endl;
-                    in_file.close();
-                } else {
-                    if (_string.size() + 1 > __data_size)
-                        block._size = __data_size;
-                    else
-                        block._size = _string.size() + 1;
-                    send_block(block_t(block_t::data, _string.c_str(), block._size));
-                    _terminal_data = false;
-                    pthread_cond_signal(&_cond);
-                    pthread_mutex_unlock(&_mutex);
+            if (!_headless)
+                std::cout << _name << ": " << std::flush;
+            wait_for(true, true);
+            if (!_network_queue->is_empty()) {
+                recv_block(block);
+                process_block(block);
+            } else if (_headless) {
+                get_string(line);
+                run_command(line);
+            } else {
+                get_string(line);
+                file_path = trim_path(line);
+                pthread_mutex_lock(&_transfer_mutex);
+                transfer = !_offers.empty() && (line == "y" || line == "n") ? _offers.front() : NULL;
+                if (transfer) {
+                    _offers.pop_front();
+                    transfer->_answer = line[0];
+                    notify(*transfer);
                 }
+                pthread_mutex_unlock(&_transfer_mutex);
+                if (transfer)
+                    continue;
+                if (file_path[0] == '/')
+                    offer_file(file_path);
+                else
+                    say(line);
             }
         } catch (const std::exception &exception) {
             std::cerr << "Error: " << exception.what() << ".\n";
@@ -344,57 +655,584 @@ void Client::shell() {
     }
 }
 
-void *Client::terminal_listener() {
-    signal(SIGTERM, thread_handler);
+void Client::run_command(const std::string &line) {
+
+    size_t pos = line.find(' ');
+    std::string command = line.substr(0, pos), argument = pos == line.npos ? "" : line.substr(pos + 1);
+
+    if (command == "accept" && !argument.empty())
+        _accept_rules.push_back(argument);
+    else if (command == "reject")
+        _accept_rules.clear();
+    else if (command == "quit") {
+        if (!_peer_name.empty())
+            wait_for_transfers();
+        disconnect();
+    } else if (_peer_name.empty() && (command == "send" || command == "say" || command == "wait"))
+        std::cerr << "Error: not connected.\n";
+    else if (command == "send" && !argument.empty())
+        offer_file(trim_path(argument));
+    else if (command == "say" && !argument.empty())
+        say(argument);
+    else if (command == "wait")
+        wait_for_transfers();
+    else
+        std::cerr << "Error: unknown command " << line << ".\n";
+}
+
+void Client::process_block(block_t &block) {
+    if (block._size && block._data[0] == '/') {
+        transfer_t inline_transfer(this, 0);
+        recv_file(inline_transfer, (char *) block._data + 1);
+    } else if (block._size)
+        std::cout << "\r" << _peer_name << ": " << block._data << std::endl;
+}
+
+void Client::offer_file(const std::string &file_path) {
+
+    transfer_t *transfer;
+    pthread_t thread;
+
+    if (_streams) {
+        transfer = new transfer_t(this, _next_stream);
+        transfer->_file_path = file_path;
+        _next_stream += 2;
+        pthread_mutex_lock(&_transfer_mutex);
+        _transfers[transfer->_stream] = transfer;
+        pthread_mutex_unlock(&_transfer_mutex);
+        pthread_create(&thread, NULL, &Client::sender, transfer);
+        pthread_detach(thread);
+    } else {
+        transfer_t inline_transfer(this, 0);
+        inline_transfer._file_path = file_path;
+        send_file(inline_transfer);
+    }
+}
+
+void Client::say(const std::string &line) {
+    send_block(block_t(block_t::data, line.c_str(), std::min((int) line.size() + 1, (int) (__data_size))));
+}
+
+bool Client::is_accepted(const std::string &file_name) {
+    for (size_t i = 0; i < _accept_rules.size(); i++)
+        if (!fnmatch(_accept_rules[i].c_str(), file_name.c_str(), 0))
+            return true;
+    return false;
+}
+
+void Client::wait_for_transfers() {
+
+    bool idle;
+    unsigned int events;
+    block_t block;
+
     while (true) {
-        std::getline(std::cin, _string);
-        if (!_string.size()) {
-            send_block(block_t(block_t::disconnect));
-            std::cout << "\nDisconnected." << std::endl;
-            this->~Client();
-            exit(EXIT_SUCCESS);
-        }
-        _terminal_data = true;
-        pthread_mutex_lock(&_mutex);
-        pthread_cond_signal(&_cond);
-        while (_terminal_data)
-            pthread_cond_wait(&_cond, &_mutex);
-        pthread_mutex_unlock(&_mutex);
+        events = _events;
+        pthread_mutex_lock(&_transfer_mutex);
+        idle = _transfers.empty();
+        pthread_mutex_unlock(&_transfer_mutex);
+        if (idle)
+            return;
+        if (!_network_queue->is_empty()) {
+            recv_block(block);
+            process_block(block);
+            continue;
+        }
+        _waiting++;
+        syscall(SYS_futex, &_events, FUTEX_WAIT_PRIVATE, events, NULL, NULL, 0);
+        _waiting--;
+    }
+}
+
+void Client::disconnect() {
+    _disconnected = true;
+    send_block(block_t(block_t::disconnect));
+    std::cout << "\nDisconnected." << std::endl;
+    this->~Client();
+    exit(EXIT_SUCCESS);
+}
+
+void Client::send_file(transfer_t &transfer) {
+
+    bool accept, resume, delta, aborted = false, stopped = false;
+    int block_size, credits = transfer._window;
+    long file_size, bytes_sent, bytes_remaining, rate, time_elapsed, wire_bytes, resume_offset = 0, chunks;
+    std::string file_name, content_id, listing, digest;
+    std::vector<std::string> hashes, records;
+    struct stat info;
+    time_t start_time;
+    timespec transfer_start;
+    pthread_t file_reader, block_encrypter;
+    block_t block, credit, sealed;
+
+    if (!stat(transfer._file_path.c_str(), &info) && S_ISDIR(info.st_mode)) {
+        if (!_folders)
+            throw std::runtime_error("peer can't receive folders");
+        while (transfer._file_path.size() > 1 && transfer._file_path[transfer._file_path.size() - 1] == '/')
+            transfer._file_path.erase(transfer._file_path.size() - 1);
+        transfer._folder = new Folder(_file_workers, _queue_depth, __data_size);
+        transfer._folder->scan(transfer._file_path);
+        file_name = transfer._file_path.substr(transfer._file_path.rfind("/")) + "/";
+        file_size = transfer._folder->size();
+    } else {
+        transfer._in_file.open(transfer._file_path.c_str(), std::ifstream::binary);
+        if (!transfer._in_file)
+            throw std::runtime_error("can't read file");
+        file_name = transfer._file_path.substr(transfer._file_path.rfind("/"));
+        transfer._in_file.seekg(0, std::ifstream::end);
+        file_size = transfer._in_file.tellg();
+        transfer._in_file.seekg(0, std::ifstream::beg);
     }
+    resume = _resume && !transfer._folder;
+    delta = _delta && !transfer._folder;
+    send_block(transfer, block_t(block_t::data, file_name.c_str(), file_name.size() + 1));
+    file_name = file_name.substr(1);
+    send_block(transfer, block_t(block_t::data, &file_size, sizeof file_size));
+    if (transfer._folder) {
+        transfer._folder->encode(listing);
+        send_string(transfer, listing);
+    } else if (resume) {
+        content_id = Manifest::content_id(transfer._file_path, transfer._in_file, file_size);
+        send_block(transfer, block_t(block_t::data, content_id.data(), content_id.size()));
+    }
+    std::cout << "Waiting for " << _peer_name << " to accept " << (transfer._stream ? file_name : "the file transfer") << "..." << std::flush;
+    recv_block(transfer, block);
+    accept = *(bool *) block._data;
+    if (accept) {
+        records.clear();
+        if (delta)
+            recv_records(transfer, records, __signature_size);
+        if (!records.empty())
+            send_delta(transfer, records, file_size);
+        else {
+            if (resume) {
+                recv_records(transfer, hashes, SHA256_DIGEST_LENGTH);
+                chunks = match_chunks(transfer, hashes);
+                for (long i = 0; i < chunks; i++)
+                    transfer._digest.add(hashes[i], std::min((long) (__data_size), file_size - i * (__data_size)));
+                send_block(transfer, block_t(block_t::data, &chunks, sizeof chunks));
+                recv_block(transfer, block);
+                resume_offset = std::min(chunks * (__data_size), file_size);
+                if (resume_offset)
+                    std::cout << "\nResuming at " << format_size(resume_offset) << "." << std::flush;
+            }
+            if (transfer._folder)
+                transfer._folder->start(true);
+            else
+                transfer._storage.open_read(transfer._file_path, resume_offset);
+            bytes_sent = resume_offset;
+            bytes_remaining = file_size - resume_offset;
+            time(&start_time);
+            std::cout << "\nSending " << file_name << (transfer._folder ? " (" + std::to_string(transfer._folder->files()) + " files)" : "") << "..." << std::flush;
+            Ring file_ring(_queue_depth), crypto_ring(_queue_depth);
+            transfer._file_ring = &file_ring;
+            transfer._crypto_ring = &crypto_ring;
+            transfer._file_size = bytes_remaining;
+            if (_parallel)
+                transfer._engine = new Engine(_crypto, true, _compress, transfer._stream ? transfer._stream : _crypto.begin_transfer(true), _crypto_threads, std::max(_queue_depth, 2 * _crypto_threads), _verify ? &transfer._digest : NULL);
+            else
+                pthread_create(&block_encrypter, NULL, &Client::block_encrypter, &transfer);
+            pthread_create(&file_reader, NULL, &Client::file_reader, &transfer);
+            if (!transfer._stream)
+                cork(true);
+            clock_gettime(CLOCK_MONOTONIC, &transfer_start);
+            wire_bytes = 0;
+            do {
+                if (!(transfer._engine ? transfer._engine->pop(block) : crypto_ring.pop(block))) {
+                    aborted = true;
+                    break;
+                }
+                while (!stopped && ((transfer._stream && !credits) || has_block(transfer))) {
+                    recv_block(transfer, credit);
+                    if (credit._cmd != block_t::abort)
+                        credits += *(int *) credit._data;
+                    else
+                        stopped = true;
+                }
+                if (stopped)
+                    break;
+                credits--;
+                if (!send_chunk(transfer, block))
+                    throw std::runtime_error("can't write to socket");
+                wire_bytes += block._size;
+                if (bytes_remaining > __data_size)
+                    block_size = __data_size;
+                else
+                    block_size = bytes_remaining;
+                bytes_sent += block_size;
+                bytes_remaining -= block_size;
+                time_elapsed = difftime(time(NULL), start_time);
+                if (transfer._stream)
+                    continue;
+                std::cout << "\r" << std::string(80, ' ') << "\rSending " << file_name << "... " << std::fixed << std::setprecision(0) << (double) bytes_sent / file_size * 100 << "%" << std::flush;
+                if (time_elapsed) {
+                    rate = (bytes_sent - resume_offset) / time_elapsed;
+                    std::cout << " (" << format_time(bytes_remaining / rate) << " at " << format_size(rate) << "/s)" << std::flush;
+                }
+            } while (bytes_remaining);
+            if (aborted || stopped) {
+                if (transfer._engine)
+                    transfer._engine->close();
+                if (!stopped || !transfer._stream)
+                    send_block(transfer, block_t(block_t::abort));
+            } else if (_verify) {
+                digest = transfer._digest.finish();
+                block = block_t(block_t::data, digest.data(), digest.size());
+                if (!transfer._engine)
+                    send_block(transfer, block);
+                else {
+                    transfer._engine->seal(sealed, block);
+                    if (!send_chunk(transfer, sealed))
+                        throw std::runtime_error("can't write to socket");
+                }
+            }
+            if (!transfer._stream)
+                cork(false);
+            pthread_join(file_reader, NULL);
+            transfer._storage.close();
+            if (transfer._folder && !transfer._folder->close())
+                transfer._failed = true;
+            if (transfer._engine) {
+                delete transfer._engine;
+                transfer._engine = NULL;
+            } else
+                pthread_join(block_encrypter, NULL);
+            while (!stopped || !transfer._stream) {
+                recv_block(transfer, credit);
+                if (credit._cmd != block_t::abort && !*(int *) credit._data)
+                    break;
+                if (credit._cmd == block_t::abort && !stopped) {
+                    if (!aborted && !transfer._stream)
+                        send_block(transfer, block_t(block_t::abort));
+                    stopped = true;
+                }
+            }
+            std::cout << std::endl;
+            if (transfer._failed)
+                throw std::runtime_error("can't read file");
+            if (aborted)
+                throw std::runtime_error("can't encrypt file");
+            if (stopped)
+                throw std::runtime_error("peer aborted the transfer");
+            print_summary("Sent", file_size - resume_offset, wire_bytes, transfer_start);
+        }
+    } else
+        std::cout << "\n" << _peer_name << " declined " << (transfer._stream ? file_name : "the file transfer") << "." << std::endl;
+    transfer._in_file.close();
+}
+
+void Client::recv_file(transfer_t &transfer, const std::string &file_name) {
+
+    bool folder, accept, resume, delta, verified = true, aborted = false, stopped = false;
+    int block_size, consumed = 0;
+    long file_size, bytes_sent, bytes_remaining, rate, time_elapsed, wire_bytes, resume_offset = 0, chunks;
+    std::string string, file_path, content_id, details;
+    std::vector<std::string> records;
+    std::vector<Chunker::chunk_t> base_chunks;
+    time_t start_time;
+    timespec transfer_start;
+    pthread_t file_writer;
+    block_t block, sealed;
+
+    recv_block(transfer, block);
+    file_size = *(long *) block._data;
+    folder = !file_name.empty() && file_name[file_name.size() - 1] == '/';
+    string = folder ? file_name.substr(0, file_name.size() - 1) : file_name;
+    if (!Folder::is_safe(string) || string.find('/') != string.npos || (folder && !_folders))
+        throw std::runtime_error("malformed block received");
+    if (folder) {
+        recv_string(transfer, string);
+        transfer._folder = new Folder(_file_workers, _queue_depth, __data_size);
+        transfer._folder->decode(string);
+        if (transfer._folder->size() != file_size)
+            throw std::runtime_error("malformed block received");
+    }
+    resume = _resume && !transfer._folder;
+    delta = _delta && !transfer._folder;
+    if (resume) {
+        recv_block(transfer, block);
+        content_id = std::string((char *) block._data, block._size);
+    }
+    details = (transfer._folder ? std::to_string(transfer._folder->files()) + " files, " : "") + format_size(file_size);
+    if (_headless) {
+        string = is_accepted(file_name) ? "y" : "n";
+        std::cout << "\r" << (string == "y" ? "Accepting" : "Declining") << " transfer of " << file_name << " (" << details << ")." << std::endl;
+    } else if (transfer._stream) {
+        pthread_mutex_lock(&_transfer_mutex);
+        _offers.push_back(&transfer);
+        pthread_mutex_unlock(&_transfer_mutex);
+        std::cout << "\r" << std::string(80, ' ') << "\rAccept transfer of " << file_name << " (" << details << ")? (y/n) " << std::flush;
+        while (!transfer._answer)
+            wait_for(transfer);
+        string = std::string(1, transfer._answer);
+        transfer._answer = 0;
+    } else
+        do {
+            std::cout << "\r" << std::string(80, ' ') << "\rAccept transfer of " << file_name << " (" << details << ")? (y/n) " << std::flush;
+            get_string(string);
+        } while (string != "y" && string != "n");
+    if (string == "n") {
+        accept = false;
+        send_block(transfer, block_t(block_t::data, &accept, sizeof accept));
+        return;
+    }
+    file_path = _file_path + file_name;
+    transfer._file_path = file_path;
+    if (transfer._folder)
+        try {
+            transfer._folder->create(file_path.substr(0, file_path.size() - 1));
+        } catch (const std::exception &exception) {
+            accept = false;
+            send_block(transfer, block_t(block_t::data, &accept, sizeof accept));
+            throw;
+        }
+    else if (resume && transfer._manifest.load(file_path, content_id))
+        transfer._out_file.open(file_path.c_str(), std::ofstream::binary | std::ofstream::in | std::ofstream::out);
+    else {
+        if (delta)
+            Chunker::index(file_path, base_chunks);
+        transfer._out_file.open((base_chunks.empty() ? file_path : file_path + __delta_suffix).c_str(), std::ofstream::binary);
+    }
+    if (!transfer._folder && !transfer._out_file) {
+        accept = false;
+        send_block(transfer, block_t(block_t::data, &accept, sizeof accept));
+        throw std::runtime_error("can't write file");
+    }
+    accept = true;
+    if (resume || delta)
+        send_block(transfer, block_t(block_t::data, &accept, sizeof accept));
+    for (size_t i = 0; i < base_chunks.size(); i++)
+        records.push_back(base_chunks[i].hash + std::string((char *) &base_chunks[i].size, sizeof base_chunks[i].size));
+    if (!records.empty() || (delta && resume))
+        send_records(transfer, records, __signature_size);
+    if (!base_chunks.empty()) {
+        recv_delta(transfer, file_size, base_chunks);
+        return;
+    }
+    if (resume) {
+        send_records(transfer, transfer._manifest.hashes(), SHA256_DIGEST_LENGTH);
+        recv_block(transfer, block);
+        chunks = *(long *) block._data;
+        if (chunks < 0 || chunks > (long) transfer._manifest.hashes().size())
+            throw std::runtime_error("malformed block received");
+        transfer._manifest.create(file_path, content_id, chunks);
+        for (long i = 0; i < chunks; i++)
+            transfer._digest.add(transfer._manifest.hashes()[i], std::min((long) (__data_size), file_size - i * (__data_size)));
+        resume_offset = std::min(chunks * (__data_size), file_size);
+        if (truncate(file_path.c_str(), resume_offset))
+            throw std::runtime_error("can't write file");
+    }
+    transfer._out_file.close();
+    if (transfer._folder)
+        transfer._folder->start(false);
+    else
+        transfer._storage.open_write(file_path, resume_offset, file_size);
+    if (_parallel) {
+        transfer._engine = new Engine(_crypto, false, _compress, transfer._stream ? transfer._stream : _crypto.begin_transfer(false), _crypto_threads, std::max(_queue_depth, 2 * _crypto_threads), _verify ? &transfer._digest : NULL);
+        if (transfer._stream)
+            transfer._receiving = true;
+        else
+            _raw_blocks = (file_size > resume_offset ? (file_size - resume_offset + __data_size - 1) / (__data_size) : 1) + _verify;
+    }
+    if (delta && !resume)
+        send_records(transfer, records, __signature_size);
+    else
+        send_block(transfer, block_t(block_t::data, &accept, sizeof accept));
+    bytes_sent = resume_offset;
+    bytes_remaining = file_size - resume_offset;
+    if (resume_offset)
+        std::cout << "\rResuming at " << format_size(resume_offset) << "." << std::endl;
+    time(&start_time);
+    std::cout << "\r" << std::string(80, ' ') << "\rReceiving " << file_name << "..." << std::flush;
+    Ring file_ring(_queue_depth);
+    transfer._file_ring = &file_ring;
+    pthread_create(&file_writer, NULL, &Client::file_writer, &transfer);
+    clock_gettime(CLOCK_MONOTONIC, &transfer_start);
+    wire_bytes = 0;
+    do {
+        recv_chunk(transfer, block);
+        if (block._cmd == block_t::abort) {
+            aborted = true;
+            break;
+        }
+        wire_bytes += block._size;
+        if (!(transfer._engine ? transfer._engine->push(block) : file_ring.push(block))) {
+            send_block(transfer, block_t(block_t::abort));
+            if (!transfer._stream)
+                do
+                    recv_block(transfer, block);
+                while (block._cmd != block_t::abort);
+            stopped = true;
+            break;
+        }
+        if (bytes_remaining > __data_size)
+            block_size = __data_size;
+        else
+            block_size = bytes_remaining;
+        bytes_sent += block_size;
+        bytes_remaining -= block_size;
+        if (transfer._stream && ++consumed == transfer._window / 2 && bytes_remaining) {
+            send_block(transfer, block_t(block_t::data, &consumed, sizeof consumed));
+            consumed = 0;
+        }
+        time_elapsed = difftime(time(NULL), start_time);
+        if (transfer._stream)
+            continue;
+        std::cout << "\r" << std::string(80, ' ') << "\rReceiving " << file_name << "... " << std::fixed << std::setprecision(0) << (double) bytes_sent / file_size * 100 << "%" << std::flush;
+        if (time_elapsed) {
+            rate = (bytes_sent - resume_offset) / time_elapsed;
+            std::cout << " (" << format_time(bytes_remaining / rate) << " at " << format_size(rate) << "/s)" << std::flush;
+        }
+    } while (bytes_sent < file_size);
+    std::cout << std::endl;
+    if (transfer._engine)
+        transfer._engine->close();
+    file_ring.close();
+    pthread_join(file_writer, NULL);
+    transfer._storage.close();
+    if (_verify && !aborted && !stopped) {
+        recv_chunk(transfer, sealed);
+        if (transfer._engine)
+            try {
+                transfer._engine->open(block, sealed);
+            } catch (...) {
+                block._size = 0;
+            }
+        else
+            block.swap(sealed);
+        verified = block._size == __digest_size && !memcmp(block._data, transfer._digest.finish().data(), __digest_size);
+    }
+    if (transfer._engine) {
+        if (transfer._engine->is_failed())
+            transfer._failed = true;
+        delete transfer._engine;
+        transfer._engine = NULL;
+    }
+    if (!transfer._failed && verified && !aborted && !stopped) {
+        if (resume)
+            transfer._manifest.remove();
+        print_summary("Received", file_size - resume_offset, wire_bytes, transfer_start);
+    }
+    if ((aborted || stopped) && !transfer._stream)
+        _raw_blocks = 0;
+    consumed = 0;
+    send_block(transfer, block_t(block_t::data, &consumed, sizeof consumed));
+    if (aborted)
+        throw std::runtime_error("peer aborted the transfer");
+    if (stopped)
+        throw std::runtime_error("can't decrypt file");
+    if (transfer._failed)
+        throw std::runtime_error("can't write file");
+    if (!verified)
+        throw std::runtime_error("file verification failed");
+}
+
+void *Client::sender(transfer_t &transfer) {
+    try {
+        send_file(transfer);
+    } catch (const std::exception &exception) {
+        std::cerr << "\nError: " << exception.what() << ".\n";
+    }
+    if (!_headless)
+        std::cout << _name << ": " << std::flush;
+    close_transfer(&transfer);
     return NULL;
 }
 
-void *Client::network_listener() {
+void *Client::receiver(transfer_t &transfer) {
 
     block_t block;
 
-    signal(SIGTERM, thread_handler);
+    try {
+        recv_block(transfer, block);
+        if (!block._size || block._data[0] != '/')
+            throw std::runtime_error("malformed block received");
+        recv_file(transfer, (char *) block._data + 1);
+    } catch (const std::exception &exception) {
+        std::cerr << "\nError: " << exception.what() << ".\n";
+    }
+    if (!_headless)
+        std::cout << _name << ": " << std::flush;
+    close_transfer(&transfer);
+    return NULL;
+}
+
+Client::transfer_t *Client::find_transfer(unsigned int stream) {
+
+    transfers_t::iterator transfer = _transfers.find(stream);
+    pthread_t thread;
+
+    if (transfer != _transfers.end())
+        return transfer->second;
+    if ((stream & 1) != (_peer_stream & 1))
+        return NULL;
+    if (stream >= _peer_stream) {
+        if (stream - _peer_stream > 2 * __stream_gap)
+            return NULL;
+        for (; _peer_stream < stream; _peer_stream += 2)
+            _skipped_streams.insert(_peer_stream);
+        _peer_stream += 2;
+    } else if (!_skipped_streams.erase(stream))
+        return NULL;
+    _transfers[stream] = new transfer_t(this, stream);
+    pthread_create(&thread, NULL, &Client::receiver, _transfers[stream]);
+    pthread_detach(thread);
+    return _transfers[stream];
+}
+
+void Client::close_transfer(transfer_t *transfer) {
+    pthread_mutex_lock(&_transfer_mutex);
+    _transfers.erase(transfer->_stream);
+    for (size_t i = 0; i < _offers.size(); i++)
+        if (_offers[i] == transfer)
+            _offers.erase(_offers.begin() + i);
+    pthread_mutex_unlock(&_transfer_mutex);
+    delete transfer;
+    notify();
+}
+
+void *Client::lane_reader(lane_t &lane) {
+
+    int header_size, available, buffered;
+    Frame::header_t frame;
+    transfers_t::iterator transfer;
+    block_t block;
+
     try {
         while (true) {
-            if (!recv(_socket, &block._cmd, sizeof block._cmd, MSG_WAITALL))
-                throw std::runtime_error("connection dropped");
-            if (!recv(_socket, &block._size, sizeof block._size, MSG_WAITALL))
-                throw std::runtime_error("connection dropped");
-            if (block._size > __block_size)
-                throw std::runtime_error("oversized block received");
-            if (block._size)
-                if (!recv(_socket, block._data, block._size, MSG_WAITALL))
-                    throw std::runtime_error("connection dropped");
-            if (block._cmd == block_t::disconnect) {
-                std::cout << "\n\nDisconnected." << std::endl;
-                this->~Client();
-                exit(EXIT_SUCCESS);
+            available = lane._end - lane._start;
+            if (!(header_size = Frame::decode(frame, lane._buffer + lane._start, available))) {
+                if (available >= __frame_header_max)
+                    throw std::runtime_error("malformed block received");
+                if (!fill_lane(lane))
+                    return NULL;
+                continue;
             }
-            if (_crypto.is_ready() && block._size)
-                _crypto.decrypt_block(_block, block);
-            else
-                _block = block;
-            _network_data = true;
-            pthread_mutex_lock(&_mutex);
-            pthread_cond_signal(&_cond);
-            while (_network_data)
-                pthread_cond_wait(&_cond, &_mutex);
-            pthread_mutex_unlock(&_mutex);
+            if (!(frame.flags & __frame_raw) || !(frame.flags & __frame_indexed) || frame.size <= (int) sizeof (unsigned long))
+                throw std::runtime_error("malformed block received");
+            block._cmd = frame.cmd;
+            block.reserve(frame.size);
+            block._size = frame.size;
+            buffered = std::min(available - header_size, frame.size);
+            memcpy(block._data, lane._buffer + lane._start + header_size, buffered);
+            lane._start += header_size + buffered;
+            if (!read_all(lane._socket, block._data + buffered, block._size - buffered))
+                return NULL;
+            Metrics::add(__metric_bytes_received, header_size + frame.size);
+            Metrics::add(__metric_blocks_received, 1);
+            pthread_mutex_lock(&_transfer_mutex);
+            transfer = _transfers.find(frame.stream);
+            if (transfer != _transfers.end() && !transfer->second->_receiving) {
+                pthread_mutex_unlock(&_transfer_mutex);
+                throw std::runtime_error("malformed block received");
+            }
+            if (transfer != _transfers.end() && !transfer->second->_inbox->push(block)) {
+                pthread_mutex_unlock(&_transfer_mutex);
+                throw std::runtime_error("stream window exceeded");
+            }
+            if (transfer != _transfers.end())
+                notify(*transfer->second);
+            pthread_mutex_unlock(&_transfer_mutex);
         }
     } catch (const std::exception &exception) {
         std::cerr << "\nError: " << exception.what() << ".";
@@ -404,53 +1242,751 @@ void *Client::network_listener() {
     return NULL;
 }
 
-void *Client::keepalive_sender() {
+bool Client::fill_lane(lane_t &lane) {
+
+    ssize_t bytes;
+
+    if (lane._start) {
+        memmove(lane._buffer, lane._buffer + lane._start, lane._end - lane._start);
+        lane._end -= lane._start;
+        lane._start = 0;
+    }
+    do
+        bytes = recv(lane._socket, lane._buffer + lane._end, __lane_buffer_size - lane._end, 0);
+    while (bytes < 0 && errno == EINTR);
+    if (bytes <= 0)
+        return false;
+    lane._end += bytes;
+    return true;
+}
+
+void *Client::event_loop() {
 
-    int interval = __timeout / 3;
+    int interval = __timeout / 3, events_size;
+    bool terminal_watched = true, socket_watched = true;
+    uint64_t count;
+    epoll_event events[5];
 
     signal(SIGTERM, thread_handler);
+    try {
+        while (true) {
+            events_size = epoll_wait(_epoll_fd, events, 5, -1);
+            if (events_size < 0 && errno != EINTR)
+                throw std::runtime_error("can't wait for events");
+            for (int i = 0; i < events_size; i++)
+                if (events[i].data.fd == _timer_fd) {
+                    if (read(_timer_fd, &count, sizeof count) > 0 && difftime(time(NULL), _time) > interval)
+                        send_block(block_t(block_t::keepalive));
+                } else if (events[i].data.fd == _batch_fd) {
+                    if (read(_batch_fd, &count, sizeof count) > 0)
+                        flush_blocks();
+                } else if (events[i].data.fd == _wake_fd) {
+                    if (read(_wake_fd, &count, sizeof count) < 0)
+                        throw std::runtime_error("can't read wake event");
+                } else if (events[i].data.fd == _control_fd) {
+                    accept_control();
+                    terminal_watched = true;
+                } else if (events[i].data.fd == _input_fd)
+                    read_terminal();
+                else if (events[i].data.fd == _socket)
+                    _socket_readable = true;
+            while (deliver_line());
+            while ((_frame_pending = _frame_pending || read_frame()) && deliver_frame())
+                _frame_pending = false;
+            if (_input_fd >= 0 && terminal_watched != (_input.find('\n') == _input.npos && !_input_closed)) {
+                terminal_watched = !terminal_watched;
+                watch(_input_fd, terminal_watched);
+            }
+            if (socket_watched != !_frame_pending) {
+                socket_watched = !socket_watched;
+                watch(_socket, socket_watched);
+            }
+        }
+    } catch (const std::exception &exception) {
+        if (_disconnected)
+            return NULL;
+        std::cerr << "\nError: " << exception.what() << ".";
+        this->~Client();
+        exit(EXIT_FAILURE);
+    }
+    return NULL;
+}
+
+void Client::read_terminal() {
+
+    char buffer[4096];
+    ssize_t bytes = read(_input_fd, buffer, sizeof buffer);
+
+    if (bytes > 0)
+        _input.append(buffer, bytes);
+    else if (bytes && (errno == EAGAIN || errno == EINTR))
+        return;
+    else if (!_headless)
+        _input_closed = true;
+    else {
+        close(_input_fd);
+        _input_fd = -1;
+        if (!_input.empty() && _input[_input.size() - 1] != '\n')
+            _input += "\n";
+    }
+}
+
+void Client::accept_control() {
+
+    int fd = accept4(_control_fd, NULL, NULL, SOCK_NONBLOCK);
+    epoll_event event;
+
+    if (fd < 0)
+        return;
+    if (_input_fd >= 0)
+        close(_input_fd);
+    _input_fd = fd;
+    event.events = EPOLLIN;
+    event.data.fd = fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &event);
+}
+
+bool Client::read_frame() {
+
+    int available;
+    ssize_t bytes;
+
     while (true) {
-        sleep(interval);
-        if (difftime(time(NULL), _time) > interval)
-            send_block(block_t(block_t::keepalive));
+        if (_direct_read) {
+            if (!_socket_readable)
+                return false;
+            bytes = recv(_socket, _frame._data + _frame_received, _frame._size - _frame_received, MSG_DONTWAIT);
+        } else {
+            available = _recv_end - _recv_start;
+            if ((_header_size = get_header(_recv_buffer + _recv_start, available))) {
+                if (available >= _header_size + _frame_size) {
+                    if (_frame_cmd == block_t::disconnect) {
+                        std::cout << "\n\nDisconnected." << std::endl;
+                        this->~Client();
+                        exit(EXIT_SUCCESS);
+                    }
+                    if (_frame_cmd != block_t::keepalive) {
+                        _frame_data = _recv_buffer + _recv_start + _header_size;
+                        return true;
+                    }
+                    _recv_start += _header_size;
+                    continue;
+                }
+                if (_frame_size > __direct_size) {
+                    _frame._cmd = _frame_cmd;
+                    _frame.reserve(_frame_size);
+                    _frame._size = _frame_size;
+                    _frame_received = available - _header_size;
+                    memcpy(_frame._data, _recv_buffer + _recv_start + _header_size, _frame_received);
+                    _recv_start = _recv_end = 0;
+                    _direct_read = true;
+                    continue;
+                }
+            }
+            if (!_socket_readable)
+                return false;
+            if (_recv_start == _recv_end)
+                _recv_start = _recv_end = 0;
+            else if (__recv_buffer_size - _recv_end < __frame_header_max + __direct_size) {
+                memmove(_recv_buffer, _recv_buffer + _recv_start, available);
+                _recv_start = 0;
+                _recv_end = available;
+            }
+            bytes = recv(_socket, _recv_buffer + _recv_end, __recv_buffer_size - _recv_end, MSG_DONTWAIT);
+        }
+        if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            _socket_readable = false;
+            return false;
+        }
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            throw std::runtime_error("connection dropped");
+        Metrics::add(__metric_bytes_received, bytes);
+        if (!_direct_read) {
+            if (bytes < __recv_buffer_size - _recv_end)
+                _socket_readable = false;
+            _recv_end += bytes;
+        } else if ((_frame_received += bytes) == _frame._size) {
+            _direct_read = false;
+            _frame_data = NULL;
+            return true;
+        } else
+            _socket_readable = false;
     }
+}
+
+bool Client::deliver_frame() {
+
+    bool raw = _frame_flags & __frame_raw || (_raw_blocks && _frame_cmd == block_t::data);
+    Queue *queue = _network_queue;
+    transfer_t *transfer = NULL;
+
+    if (_handshaking && !_frame_wanted)
+        return false;
+    if (_frame_stream) {
+        pthread_mutex_lock(&_transfer_mutex);
+        if (!(transfer = find_transfer(_frame_stream))) {
+            pthread_mutex_unlock(&_transfer_mutex);
+            if (_crypto.is_ready() && !raw)
+                _crypto.decrypt_block(_plain, _frame_cmd, _frame_stream, _frame_flags, _frame_data ? _frame_data : _frame._data, _frame_size);
+            if (_frame_data)
+                _recv_start += _header_size + _frame_size;
+            return true;
+        }
+        queue = transfer->_inbox;
+    }
+    if (_frame_flags & __frame_raw ? _frame_cmd != block_t::data || !(transfer && transfer->_receiving) : _frame_cmd == block_t::data && transfer && transfer->_receiving) {
+        if (transfer)
+            pthread_mutex_unlock(&_transfer_mutex);
+        throw std::runtime_error("malformed block received");
+    }
+    if (queue->is_full()) {
+        _blocked = true;
+        if (queue->is_full()) {
+            if (transfer)
+                pthread_mutex_unlock(&_transfer_mutex);
+            return false;
+        }
+    }
+    _frame_wanted = false;
+    if (_crypto.is_ready() && !raw)
+        _crypto.decrypt_block(_plain, _frame_cmd, _frame_stream, _frame_flags, _frame_data ? _frame_data : _frame._data, _frame_size);
+    else if (_frame_data) {
+        _plain._cmd = _frame_cmd;
+        _plain.reserve(_frame_size);
+        _plain._size = _frame_size;
+        memcpy(_plain._data, _frame_data, _frame_size);
+    } else
+        _plain.swap(_frame);
+    if (_raw_blocks && _frame_cmd == block_t::data && !_frame_stream)
+        _raw_blocks--;
+    if (_frame_data)
+        _recv_start += _header_size + _frame_size;
+    queue->push(_plain);
+    Metrics::add(__metric_blocks_received, 1);
+    if (transfer) {
+        notify(*transfer);
+        pthread_mutex_unlock(&_transfer_mutex);
+    } else
+        notify();
+    return true;
+}
+
+bool Client::deliver_line() {
+
+    size_t pos = _input.find('\n');
+    std::string line;
+    block_t block;
+
+    if (pos == _input.npos && !_input_closed)
+        return false;
+    if (_handshaking)
+        return false;
+    if (_terminal_queue->is_full()) {
+        _blocked = true;
+        if (_terminal_queue->is_full())
+            return false;
+    }
+    line = _input.substr(0, pos);
+    _input.erase(0, pos == _input.npos ? pos : pos + 1);
+    if (!line.size() && _headless)
+        return true;
+    if (!line.size())
+        disconnect();
+    block = block_t(block_t::data, line.c_str(), line.size() + 1);
+    _terminal_queue->push(block);
+    notify();
+    return true;
+}
+
+void Client::watch(int fd, bool enable) {
+
+    epoll_event event;
+
+    event.events = enable ? EPOLLIN : 0;
+    event.data.fd = fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &event);
+}
+
+void Client::wake() {
+
+    uint64_t count = 1;
+
+    if (write(_wake_fd, &count, sizeof count) < 0)
+        std::cerr << "\nError: can't wake event loop.";
+}
+
+void *Client::file_reader(transfer_t &transfer) {
+
+    long bytes_remaining = transfer._file_size;
+    unsigned char leaf[__digest_size];
+    block_t block;
+
+    do {
+        block._cmd = block_t::data;
+        if (!(transfer._folder ? transfer._folder->read(block) : transfer._storage.read(block, std::min(bytes_remaining, (long) __data_size)))) {
+            transfer._failed = true;
+            break;
+        }
+        bytes_remaining -= block._size;
+        if (!transfer._engine && _verify) {
+            Digest::leaf(leaf, block);
+            transfer._digest.add(leaf, block._size);
+        }
+        if (!(transfer._engine ? transfer._engine->push(block) : transfer._file_ring->push(block)))
+            break;
+    } while (bytes_remaining);
+    if (transfer._engine)
+        transfer._engine->close();
+    else
+        transfer._file_ring->close();
+    return NULL;
+}
+
+void *Client::block_encrypter(transfer_t &transfer) {
+
+    block_t block, encrypted_block, packed_block;
+    Compressor compressor;
+
+    while (transfer._file_ring->pop(block)) {
+        if (_compress && block._size) {
+            compressor.compress(packed_block, block);
+            block.swap(packed_block);
+        }
+        _crypto.encrypt_block(encrypted_block, block);
+        transfer._crypto_ring->push(encrypted_block);
+    }
+    transfer._crypto_ring->close();
+    return NULL;
+}
+
+void *Client::file_writer(transfer_t &transfer) {
+
+    bool written;
+    unsigned char leaf[__digest_size];
+    timespec start;
+    block_t block, packed_block;
+    Compressor compressor;
+
+    while (transfer._engine ? transfer._engine->pop(block) : transfer._file_ring->pop(block)) {
+        if (!transfer._engine && _compress && block._size) {
+            try {
+                compressor.decompress(packed_block, block);
+                block.swap(packed_block);
+            } catch (const std::exception &exception) {
+                transfer._failed = true;
+                continue;
+            }
+        }
+        if (!transfer._engine && _verify) {
+            Digest::leaf(leaf, block);
+            transfer._digest.add(leaf, block._size);
+        }
+        Metrics::begin(start);
+        if (transfer._folder)
+            written = transfer._folder->write(block);
+        else
+            written = transfer._storage.write(block) && (!_resume || transfer._storage.flush());
+        Metrics::end(__metric_disk_write_ns, start);
+        if (!written)
+            transfer._failed = true;
+        else if (_resume && !transfer._folder && block._size) {
+            if (_verify)
+                transfer._manifest.append(transfer._digest.last());
+            else
+                transfer._manifest.append(block._data, block._size);
+        }
+    }
+    if (transfer._folder ? !transfer._folder->close() : !transfer._storage.flush())
+        transfer._failed = true;
     return NULL;
 }
 
 void Client::send_block(const block_t &source) {
 
+    bool written;
     block_t block;
 
-    signal(SIGPIPE, SIG_IGN);
-    if (_crypto.is_ready() && source._size)
+    _scheduler.begin_urgent();
+    pthread_mutex_lock(&_seal_mutex);
+    if (_crypto.is_ready() && source._cmd != block_t::keepalive && source._cmd != block_t::disconnect) {
         _crypto.encrypt_block(block, source);
-    else
-        block = source;
-    send(_socket, &block._cmd, sizeof block._cmd, 0);
-    send(_socket, &block._size, sizeof block._size, 0);
-    if (block._size)
-        send(_socket, block._data, block._size, 0);
+        written = write_block(block, 0);
+    } else
+        written = write_block(source, 0);
+    pthread_mutex_unlock(&_seal_mutex);
+    _scheduler.end_urgent();
+    if (!written)
+        throw std::runtime_error("can't write to socket");
+}
+
+void Client::send_block(transfer_t &transfer, block_t block) {
+    block._stream = transfer._stream;
+    send_block(block);
+}
+
+bool Client::write_block(const block_t &source, int flags) {
+
+    int header_size, count = 0;
+    bool written;
+    unsigned char header[__frame_header_max];
+    iovec iov[3];
+    itimerspec timer;
+
+    Metrics::add(__metric_blocks_sent, 1);
+    pthread_mutex_lock(&_send_mutex);
+    header_size = put_header(header, source, flags);
+    if (_batch_window && header_size + source._size <= __batch_size - (int) _batch.size()) {
+        if (_batch.empty()) {
+            timer.it_value.tv_sec = _batch_window / 1000000;
+            timer.it_value.tv_nsec = _batch_window % 1000000 * 1000;
+            timer.it_interval.tv_sec = timer.it_interval.tv_nsec = 0;
+            timerfd_settime(_batch_fd, 0, &timer, NULL);
+        }
+        _batch.append((char *) header, header_size);
+        _batch.append((char *) source._data, source._size);
+        pthread_mutex_unlock(&_send_mutex);
+        return true;
+    }
+    if (!_batch.empty()) {
+        iov[count].iov_base = (void *) _batch.data();
+        iov[count++].iov_len = _batch.size();
+    }
+    iov[count].iov_base = header;
+    iov[count++].iov_len = header_size;
+    if (source._size) {
+        iov[count].iov_base = source._data;
+        iov[count++].iov_len = source._size;
+    }
+    written = write_all(_socket, iov, count);
+    _batch.clear();
     time(&_time);
+    pthread_mutex_unlock(&_send_mutex);
+    return written;
+}
+
+Client::lane_t *Client::pick_lane() {
+
+    int queued, least = 0;
+    size_t lane = 0, slot;
+
+    for (size_t i = 0; i <= _lanes.size(); i++) {
+        slot = (_next_lane + i) % (_lanes.size() + 1);
+        if (ioctl(slot ? _lanes[slot - 1]->_socket : _socket, SIOCOUTQ, &queued))
+            continue;
+        if (!i || queued < least) {
+            least = queued;
+            lane = slot;
+        }
+    }
+    _next_lane = lane + 1;
+    return lane ? _lanes[lane - 1] : NULL;
+}
+
+bool Client::write_chunk(lane_t *lane, const block_t &source, unsigned long index) {
+
+    int count = 0;
+    bool written;
+    unsigned char header[__frame_header_max];
+    Frame::header_t frame;
+    iovec iov[4];
+
+    frame.cmd = source._cmd;
+    frame.flags = __frame_raw | __frame_indexed;
+    frame.stream = source._stream;
+    frame.size = source._size + sizeof index;
+    Metrics::add(__metric_blocks_sent, 1);
+    pthread_mutex_lock(lane ? &lane->_mutex : &_send_mutex);
+    if (!lane && !_batch.empty()) {
+        iov[count].iov_base = (void *) _batch.data();
+        iov[count++].iov_len = _batch.size();
+    }
+    iov[count].iov_base = header;
+    iov[count++].iov_len = Frame::encode(header, frame);
+    iov[count].iov_base = source._data;
+    iov[count++].iov_len = source._size;
+    iov[count].iov_base = &index;
+    iov[count++].iov_len = sizeof index;
+    written = write_all(lane ? lane->_socket : _socket, iov, count);
+    if (!lane) {
+        _batch.clear();
+        time(&_time);
+    }
+    pthread_mutex_unlock(lane ? &lane->_mutex : &_send_mutex);
+    return written;
+}
+
+bool Client::send_chunk(transfer_t &transfer, block_t &block) {
+
+    bool written;
+
+    block._stream = transfer._stream;
+    _scheduler.begin_bulk();
+    if (transfer._stream && !_lanes.empty())
+        written = write_chunk(pick_lane(), block, transfer._next_chunk++);
+    else
+        written = write_block(block, transfer._stream ? __frame_raw : 0);
+    _scheduler.end_bulk();
+    return written;
+}
+
+void Client::flush_blocks() {
+
+    bool written = true;
+    iovec iov;
+
+    pthread_mutex_lock(&_send_mutex);
+    if (!_batch.empty()) {
+        iov.iov_base = (void *) _batch.data();
+        iov.iov_len = _batch.size();
+        written = write_all(_socket, &iov, 1);
+        _batch.clear();
+        time(&_time);
+    }
+    pthread_mutex_unlock(&_send_mutex);
+    if (!written)
+        throw std::runtime_error("can't write to socket");
+}
+
+int Client::put_header(unsigned char *dest, const block_t &source, int flags) {
+
+    Frame::header_t header;
+
+    if (!_compact) {
+        memcpy(dest, &source._cmd, sizeof source._cmd);
+        memcpy(dest + sizeof source._cmd, &source._size, sizeof source._size);
+        return sizeof source._cmd + sizeof source._size;
+    }
+    header.cmd = source._cmd;
+    header.flags = flags;
+    header.stream = source._stream;
+    header.size = source._size;
+    return Frame::encode(dest, header);
+}
+
+int Client::get_header(const unsigned char *source, int size) {
+
+    int header_size = sizeof _frame_cmd + sizeof _frame_size;
+    Frame::header_t header;
+
+    if (size && Frame::is_compact(source[0])) {
+        if (!(header_size = Frame::decode(header, source, size)))
+            return 0;
+        _frame_cmd = header.cmd;
+        _frame_size = header.size;
+        _frame_flags = header.flags;
+        _frame_stream = header.stream;
+        return header_size;
+    }
+    if (size < header_size)
+        return 0;
+    memcpy(&_frame_cmd, source, sizeof _frame_cmd);
+    memcpy(&_frame_size, source + sizeof _frame_cmd, sizeof _frame_size);
+    _frame_flags = _frame_stream = 0;
+    if (_frame_size < 0 || _frame_size > __block_size)
+        throw std::runtime_error("oversized block received");
+    return header_size;
+}
+
+bool Client::write_all(int socket, iovec *iov, int count) {
+
+    ssize_t bytes;
+    msghdr message;
+    timespec start;
+
+    Metrics::begin(start);
+    memset(&message, 0, sizeof message);
+    message.msg_iov = iov;
+    message.msg_iovlen = count;
+    while (message.msg_iovlen) {
+        bytes = sendmsg(socket, &message, MSG_NOSIGNAL);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes < 0)
+            return false;
+        Metrics::add(__metric_bytes_sent, bytes);
+        while (message.msg_iovlen && bytes >= (ssize_t) message.msg_iov->iov_len) {
+            bytes -= message.msg_iov->iov_len;
+            message.msg_iov++;
+            message.msg_iovlen--;
+        }
+        if (message.msg_iovlen) {
+            message.msg_iov->iov_base = (char *) message.msg_iov->iov_base + bytes;
+            message.msg_iov->iov_len -= bytes;
+        }
+    }
+    Metrics::end(__metric_send_ns, start);
+    return true;
+}
+
+bool Client::read_all(int socket, void *data, int size) {
+
+    ssize_t bytes;
+
+    while (size) {
+        bytes = recv(socket, data, size, MSG_WAITALL);
+        if (bytes < 0 && errno == EINTR)
+            continue;
+        if (bytes <= 0)
+            return false;
+        data = (char *) data + bytes;
+        size -= bytes;
+    }
+    return true;
+}
+
+void Client::lane_send(int socket, const block_t &source) {
+
+    unsigned char header[sizeof source._cmd + sizeof source._size];
+    iovec iov[2];
+
+    memcpy(header, &source._cmd, sizeof source._cmd);
+    memcpy(header + sizeof source._cmd, &source._size, sizeof source._size);
+    iov[0].iov_base = header;
+    iov[0].iov_len = sizeof header;
+    iov[1].iov_base = source._data;
+    iov[1].iov_len = source._size;
+    if (!write_all(socket, iov, source._size ? 2 : 1))
+        throw std::runtime_error("can't write to socket");
+}
+
+void Client::lane_recv(int socket, block_t &dest) {
+
+    int size;
+
+    if (!read_all(socket, &dest._cmd, sizeof dest._cmd) || !read_all(socket, &size, sizeof size))
+        throw std::runtime_error("connection dropped");
+    if (size < 0 || size > __block_size)
+        throw std::runtime_error("oversized block received");
+    dest.reserve(size + 1);
+    dest._size = size;
+    dest._data[size] = 0;
+    if (!read_all(socket, dest._data, size))
+        throw std::runtime_error("connection dropped");
+}
+
+void Client::cork(bool enable) {
+
+    int value = enable;
+
+    setsockopt(_socket, IPPROTO_TCP, TCP_CORK, &value, sizeof value);
 }
 
 void Client::recv_block(block_t &dest) {
-    pthread_mutex_lock(&_mutex);
-    while (!_network_data)
-        pthread_cond_wait(&_cond, &_mutex);
-    dest = _block;
-    _network_data = false;
-    pthread_cond_signal(&_cond);
-    pthread_mutex_unlock(&_mutex);
+    if (_handshaking && _network_queue->is_empty()) {
+        _frame_wanted = true;
+        wake();
+    }
+    wait_for(true, false);
+    _network_queue->pop(dest);
+    if (_blocked.exchange(false))
+        wake();
+}
+
+void Client::recv_block(transfer_t &transfer, block_t &dest) {
+    if (!transfer._inbox) {
+        recv_block(dest);
+        return;
+    }
+    wait_for(transfer);
+    transfer._inbox->pop(dest);
+    if (_blocked.exchange(false))
+        wake();
+}
+
+bool Client::has_block(transfer_t &transfer) const {
+    return !(transfer._inbox ? transfer._inbox : _network_queue)->is_empty();
+}
+
+void Client::recv_chunk(transfer_t &transfer, block_t &dest) {
+
+    unsigned long index;
+    std::map<unsigned long, block_t>::iterator held;
+
+    if (_lanes.empty()) {
+        recv_block(transfer, dest);
+        return;
+    }
+    while ((held = transfer._held.find(transfer._next_chunk)) == transfer._held.end()) {
+        recv_block(transfer, dest);
+        if (dest._cmd == block_t::abort)
+            return;
+        if (dest._size <= (int) sizeof index)
+            throw std::runtime_error("malformed block received");
+        dest._size -= sizeof index;
+        memcpy(&index, dest._data + dest._size, sizeof index);
+        if (index == transfer._next_chunk) {
+            transfer._next_chunk++;
+            return;
+        }
+        if (index < transfer._next_chunk || (int) transfer._held.size() >= transfer._window)
+            throw std::runtime_error("malformed block received");
+        transfer._held[index].swap(dest);
+    }
+    dest.swap(held->second);
+    transfer._held.erase(held);
+    transfer._next_chunk++;
 }
 
 void Client::get_string(std::string &dest) {
-    pthread_mutex_lock(&_mutex);
-    while (!_terminal_data)
-        pthread_cond_wait(&_cond, &_mutex);
-    dest = _string;
-    _terminal_data = false;
-    pthread_cond_signal(&_cond);
-    pthread_mutex_unlock(&_mutex);
+
+    block_t block;
+
+    wait_for(false, true);
+    _terminal_queue->pop(block);
+    if (_blocked.exchange(false))
+        wake();
+    dest = (char *) block._data;
+}
+
+void Client::wait_for(bool network, bool terminal) {
+
+    unsigned int events;
+    timespec start;
+
+    Metrics::begin(start);
+    while (true) {
+        events = _events;
+        if ((network && !_network_queue->is_empty()) || (terminal && !_terminal_queue->is_empty())) {
+            if (network && !terminal)
+                Metrics::end(__metric_wait_ns, start);
+            return;
+        }
+        _waiting++;
+        syscall(SYS_futex, &_events, FUTEX_WAIT_PRIVATE, events, NULL, NULL, 0);
+        _waiting--;
+    }
+}
+
+void Client::wait_for(transfer_t &transfer) {
+
+    unsigned int events;
+    timespec start;
+
+    Metrics::begin(start);
+    while (true) {
+        events = transfer._events;
+        if (!transfer._inbox->is_empty() || transfer._answer) {
+            Metrics::end(__metric_wait_ns, start);
+            return;
+        }
+        transfer._waiting++;
+        syscall(SYS_futex, &transfer._events, FUTEX_WAIT_PRIVATE, events, NULL, NULL, 0);
+        transfer._waiting--;
+    }
+}
+
+void Client::notify() {
+    _events++;
+    if (_waiting)
+        syscall(SYS_futex, &_events, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+void Client::notify(transfer_t &transfer) {
+    transfer._events++;
+    if (transfer._waiting)
+        syscall(SYS_futex, &transfer._events, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
 }
 
 std::string Client::trim_path(std::string path) {
@@ -494,6 +2030,270 @@ std::string Client::format_size(long bytes) {
     return string;
 }
 
+void Client::send_records(transfer_t &transfer, const std::vector<std::string> &records, int record_size) {
+
+    long count = records.size(), batch = (__data_size) / record_size;
+    std::string data;
+
+    send_block(transfer, block_t(block_t::data, &count, sizeof count));
+    for (long i = 0; i < count; i += batch) {
+        data.clear();
+        for (long j = i; j < std::min(count, i + batch); j++)
+            data += records[j];
+        send_block(transfer, block_t(block_t::data, data.data(), data.size()));
+    }
+}
+
+void Client::recv_records(transfer_t &transfer, std::vector<std::string> &records, int record_size) {
+
+    long count;
+    block_t block;
+
+    records.clear();
+    recv_block(transfer, block);
+    count = *(long *) block._data;
+    while ((long) records.size() < count) {
+        recv_block(transfer, block);
+        if (!block._size || block._size % record_size)
+            throw std::runtime_error("malformed block received");
+        for (int i = 0; i < block._size; i += record_size)
+            records.push_back(std::string((char *) block._data + i, record_size));
+    }
+}
+
+void Client::send_string(transfer_t &transfer, const std::string &data) {
+
+    long size = data.size();
+
+    send_block(transfer, block_t(block_t::data, &size, sizeof size));
+    for (long i = 0; i < size; i += __data_size)
+        send_block(transfer, block_t(block_t::data, data.data() + i, std::min(size - i, (long) (__data_size))));
+}
+
+void Client::recv_string(transfer_t &transfer, std::string &data) {
+
+    long size;
+    block_t block;
+
+    data.clear();
+    recv_block(transfer, block);
+    size = *(long *) block._data;
+    while ((long) data.size() < size) {
+        recv_block(transfer, block);
+        if (!block._size || (long) (data.size() + block._size) > size)
+            throw std::runtime_error("malformed block received");
+        data.append((char *) block._data, block._size);
+    }
+}
+
+long Client::match_chunks(transfer_t &transfer, const std::vector<std::string> &hashes) {
+
+    long chunks = 0;
+    block_t block(block_t::data, __data_size);
+
+    transfer._in_file.seekg(0, std::ifstream::beg);
+    while (chunks < (long) hashes.size()) {
+        transfer._in_file.read((char *) block._data, __data_size);
+        if (transfer._in_file.gcount() != __data_size || Manifest::hash(block._data, __data_size) != hashes[chunks])
+            break;
+        chunks++;
+    }
+    transfer._in_file.clear();
+    return chunks;
+}
+
+void Client::send_delta(transfer_t &transfer, const std::vector<std::string> &signatures, long file_size) {
+
+    bool stopped = false;
+    int size;
+    long first = 0, count = 0, reference[2], wire_bytes = 0, bytes_sent = 0;
+    size_t used = 0, pos = 0;
+    std::string signature;
+    std::map<std::string, long> known;
+    std::map<std::string, long>::iterator match;
+    std::vector<unsigned char> buffer(4 * __chunk_max);
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256_CTX context;
+    timespec start_time;
+    block_t block, packed_block;
+    Compressor compressor;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    for (size_t i = 0; i < signatures.size(); i++)
+        known.insert(std::make_pair(signatures[i], (long) i));
+    SHA256_Init(&context);
+    transfer._in_file.clear();
+    transfer._in_file.seekg(0, std::ifstream::beg);
+    while (!(stopped = has_block(transfer))) {
+        if (used - pos < __chunk_max && transfer._in_file) {
+            used -= pos;
+            memmove(&buffer[0], &buffer[pos], used);
+            pos = 0;
+            transfer._in_file.read((char *) &buffer[used], buffer.size() - used);
+            used += transfer._in_file.gcount();
+        }
+        if (pos == used)
+            break;
+        size = Chunker::cut(&buffer[pos], used - pos);
+        SHA256_Update(&context, &buffer[pos], size);
+        SHA256(&buffer[pos], size, digest);
+        signature = std::string((char *) digest, sizeof digest) + std::string((char *) &size, sizeof size);
+        match = known.find(signature);
+        if (count && (match == known.end() || match->second != first + count)) {
+            reference[0] = first;
+            reference[1] = count;
+            block = block_t(block_t::data, 1 + sizeof reference);
+            block._data[0] = 'r';
+            memcpy(block._data + 1, reference, sizeof reference);
+            send_block(transfer, block);
+            wire_bytes += block._size;
+            count = 0;
+        }
+        if (match != known.end()) {
+            if (!count)
+                first = match->second;
+            count++;
+        } else {
+            block = block_t(block_t::data, &buffer[pos], size);
+            if (_compress) {
+                compressor.compress(packed_block, block);
+                block.swap(packed_block);
+            }
+            packed_block = block_t(block_t::data, block._size + 1);
+            packed_block._data[0] = 'l';
+            memcpy(packed_block._data + 1, block._data, block._size);
+            wire_bytes += packed_block._size;
+            send_block(transfer, std::move(packed_block));
+        }
+        pos += size;
+        bytes_sent += size;
+        std::cout << "\r" << std::string(80, ' ') << "\rSending changes... " << std::fixed << std::setprecision(0) << (double) bytes_sent / file_size * 100 << "%" << std::flush;
+    }
+    if (count && !stopped) {
+        reference[0] = first;
+        reference[1] = count;
+        block = block_t(block_t::data, 1 + sizeof reference);
+        block._data[0] = 'r';
+        memcpy(block._data + 1, reference, sizeof reference);
+        send_block(transfer, block);
+        wire_bytes += block._size;
+    }
+    if (!stopped) {
+        SHA256_Final(digest, &context);
+        block = block_t(block_t::data, 1 + sizeof digest);
+        block._data[0] = 'e';
+        memcpy(block._data + 1, digest, sizeof digest);
+        send_block(transfer, block);
+    }
+    recv_block(transfer, block);
+    std::cout << std::endl;
+    if (block._cmd == block_t::abort) {
+        if (!transfer._stream)
+            send_block(transfer, block_t(block_t::abort));
+        throw std::runtime_error("peer aborted the transfer");
+    }
+    print_summary("Sent", file_size, wire_bytes, start_time);
+}
+
+void Client::recv_delta(transfer_t &transfer, long file_size, const std::vector<Chunker::chunk_t> &base_chunks) {
+
+    bool verified = false;
+    int consumed = 0;
+    long reference[2], bytes_received = 0, bytes_reused = 0, wire_bytes = 0;
+    std::string file_path = transfer._file_path, temp_path = file_path + __delta_suffix;
+    std::vector<Chunker::chunk_t> chunks;
+    std::ifstream base_file(file_path.c_str(), std::ifstream::binary);
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256_CTX context;
+    timespec start_time;
+    block_t block, packed_block(block_t::data, __chunk_max);
+    Chunker::chunk_t chunk;
+    Compressor compressor;
+
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+    SHA256_Init(&context);
+    try {
+        while (!verified) {
+            recv_block(transfer, block);
+            wire_bytes += block._size;
+            if (block._size == 1 + (int) sizeof reference && block._data[0] == 'r') {
+                memcpy(reference, block._data + 1, sizeof reference);
+                if (reference[0] < 0 || reference[1] < 1 || reference[0] + reference[1] > (long) base_chunks.size())
+                    throw std::runtime_error("malformed block received");
+                base_file.seekg(base_chunks[reference[0]].offset, std::ifstream::beg);
+                for (long i = reference[0]; i < reference[0] + reference[1]; i++) {
+                    chunk = base_chunks[i];
+                    packed_block.reserve(chunk.size);
+                    if (!base_file.read((char *) packed_block._data, chunk.size))
+                        throw std::runtime_error("can't read file");
+                    SHA256_Update(&context, packed_block._data, chunk.size);
+                    if (!transfer._out_file.write((char *) packed_block._data, chunk.size))
+                        throw std::runtime_error("can't write file");
+                    chunk.offset = bytes_received;
+                    chunks.push_back(chunk);
+                    bytes_received += chunk.size;
+                    bytes_reused += chunk.size;
+                }
+            } else if (block._size > 1 && block._data[0] == 'l') {
+                packed_block = block_t(block_t::data, block._data + 1, block._size - 1);
+                if (_compress) {
+                    compressor.decompress(block, packed_block);
+                    block.swap(packed_block);
+                }
+                SHA256_Update(&context, packed_block._data, packed_block._size);
+                if (!transfer._out_file.write((char *) packed_block._data, packed_block._size))
+                    throw std::runtime_error("can't write file");
+                SHA256(packed_block._data, packed_block._size, digest);
+                chunk.offset = bytes_received;
+                chunk.size = packed_block._size;
+                chunk.hash = std::string((char *) digest, sizeof digest);
+                chunks.push_back(chunk);
+                bytes_received += chunk.size;
+            } else if (block._size == 1 + (int) sizeof digest && block._data[0] == 'e') {
+                SHA256_Final(digest, &context);
+                if (bytes_received != file_size || memcmp(digest, block._data + 1, sizeof digest))
+                    throw std::runtime_error("file verification failed");
+                verified = true;
+            } else
+                throw std::runtime_error("malformed block received");
+            if (bytes_received > file_size)
+                throw std::runtime_error("malformed block received");
+            std::cout << "\r" << std::string(80, ' ') << "\rReceiving changes... " << std::fixed << std::setprecision(0) << (double) bytes_received / file_size * 100 << "%" << std::flush;
+        }
+        transfer._out_file.close();
+        base_file.close();
+        if (rename(temp_path.c_str(), file_path.c_str()))
+            throw std::runtime_error("can't write file");
+    } catch (...) {
+        transfer._out_file.close();
+        unlink(temp_path.c_str());
+        send_block(transfer, block_t(block_t::abort));
+        if (!transfer._stream)
+            do
+                recv_block(transfer, block);
+            while (block._cmd != block_t::abort);
+        throw;
+    }
+    Chunker::save_index(file_path, chunks);
+    if (file_size)
+        std::cout << "\nReused " << format_size(bytes_reused) << " of " << format_size(file_size) << " (" << std::fixed << std::setprecision(0) << (double) bytes_reused / file_size * 100 << "%)." << std::endl;
+    print_summary("Received", file_size, wire_bytes, start_time);
+    send_block(transfer, block_t(block_t::data, &consumed, sizeof consumed));
+}
+
+void Client::print_summary(const std::string &action, long file_size, long wire_bytes, const timespec &start_time) {
+
+    timespec end_time;
+    double seconds;
+
+    clock_gettime(CLOCK_MONOTONIC, &end_time);
+    seconds = end_time.tv_sec - start_time.tv_sec + (end_time.tv_nsec - start_time.tv_nsec) / 1e9;
+    std::cout << action << " " << format_size(file_size) << " in " << std::fixed << std::setprecision(1) << seconds << " s (" << format_size(file_size / std::max(seconds, 1e-3)) << "/s effective";
+    if (_compress && wire_bytes)
+        std::cout << ", " << std::setprecision(1) << (double) file_size / wire_bytes << "x compression";
+    std::cout << ")." << std::endl;
+}
+
 std::string Client::format_time(long seconds) {
 
     int hrs = 60 * 60, min = 60;
@@ -17,19 +17,80 @@
 #define	client_h
 
 #include <vector>
+#include <algorithm>
+#include <map>
+#include <climits>
+#include <deque>
+#include <set>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
 #include <iostream>
 #include <netdb.h>
+#include <fnmatch.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <errno.h>
 #include <stdlib.h>
+#include <time.h>
 #include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/ioctl.h>
+#include <linux/sockios.h>
+#include <netinet/tcp.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
 #include "crypto.h"
+#include "ring.h"
+#include "queue.h"
+#include "engine.h"
+#include "frame.h"
+#include "compressor.h"
+#include "manifest.h"
+#include "chunker.h"
+#include "storage.h"
+#include "folder.h"
+#include "scheduler.h"
+#include "tickets.h"
 
-#define __version       4.3
+#define __version       4.4
 #define __timeout       30
+#define __terminal_depth    16
+#define __batch_size    4096
+#define __recv_buffer_size  256 * 1024
+#define __direct_size   64 * 1024
+#define __lane_buffer_size  64 * 1024
+#define __signature_size    (SHA256_DIGEST_LENGTH + sizeof(int))
+#define __delta_suffix  ".safechat-delta"
+#define __stream_window 8
+#define __stream_gap    64
+#define __stripe_max    8
+#define __stripe_rtt    5000
+#define __lane_key_size 16
+#define __file_workers  4
+#define __hello_nonce_size  32
+
+#define __feature_dh_group  0x1
+#define __feature_x25519    0x2
+#define __feature_aes_gcm   0x4
+#define __feature_chacha20  0x8
+#define __feature_parallel  0x10
+#define __feature_compact   0x20
+#define __feature_compress  0x40
+#define __feature_resume    0x80
+#define __feature_delta     0x100
+#define __feature_streams   0x200
+#define __feature_stripes   0x400
+#define __feature_folders   0x800
+#define __feature_verify    0x1000
+#define __feature_tickets   0x2000
+
+#define __server_transparent    0x1
 
 class Client {
 public:
@@ -39,16 +100,32 @@ public:
 
     void start();
 
-    static void *terminal_listener(void *client) {
-        return ((Client *) client)->terminal_listener();
+    static void *event_loop(void *client) {
+        return ((Client *) client)->event_loop();
     }
 
-    static void *network_listener(void *client) {
-        return ((Client *) client)->network_listener();
+    static void *sender(void *transfer) {
+        return ((transfer_t *) transfer)->_client->sender(*(transfer_t *) transfer);
     }
 
-    static void *keepalive_sender(void *client) {
-        return ((Client *) client)->keepalive_sender();
+    static void *receiver(void *transfer) {
+        return ((transfer_t *) transfer)->_client->receiver(*(transfer_t *) transfer);
+    }
+
+    static void *file_reader(void *transfer) {
+        return ((transfer_t *) transfer)->_client->file_reader(*(transfer_t *) transfer);
+    }
+
+    static void *block_encrypter(void *transfer) {
+        return ((transfer_t *) transfer)->_client->block_encrypter(*(transfer_t *) transfer);
+    }
+
+    static void *file_writer(void *transfer) {
+        return ((transfer_t *) transfer)->_client->file_writer(*(transfer_t *) transfer);
+    }
+
+    static void *lane_reader(void *lane) {
+        return ((lane_t *) lane)->_client->lane_reader(*(lane_t *) lane);
     }
 
     static void thread_handler(int signal) {
@@ -59,26 +136,159 @@ private:
 
     typedef std::vector<std::pair<int, std::string> > peers_t;
 
-    bool _network_data, _terminal_data;
-    int _port, _socket;
-    std::string _config_path, _name, _server, _file_path, _peer_name, _string;
+    // State of one file transfer, run inline on stream 0 or on its own thread
+    struct transfer_t {
+
+        Client *_client;
+        bool _failed;
+        int _window;
+        unsigned int _stream;
+        unsigned long _next_chunk;
+        std::atomic<int> _answer;
+        std::atomic<bool> _receiving;
+        std::atomic<int> _waiting;
+        std::atomic<unsigned int> _events;
+        long _file_size;
+        std::string _file_path;
+        std::ifstream _in_file;
+        std::ofstream _out_file;
+        Queue *_inbox;
+        Ring *_file_ring, *_crypto_ring;
+        Engine *_engine;
+        Folder *_folder;
+        Storage _storage;
+        Manifest _manifest;
+        Digest _digest;
+        std::map<unsigned long, block_t> _held;
+
+        transfer_t(Client *client, unsigned int stream) : _answer(0), _receiving(false), _waiting(0), _events(0) {
+            _client = client;
+            _failed = false;
+            _window = __stream_window * (client->_lanes.size() + 1);
+            _stream = stream;
+            _next_chunk = 0;
+            _file_size = 0;
+            _inbox = stream ? new Queue(_window + __terminal_depth) : NULL;
+            _file_ring = _crypto_ring = NULL;
+            _engine = NULL;
+            _folder = NULL;
+            _storage.set_mode(client->_file_io);
+            _storage.set_preallocate(client->_preallocate);
+        }
+
+        ~transfer_t() {
+            delete _inbox;
+            delete _folder;
+        }
+
+    };
+
+    typedef std::map<unsigned int, transfer_t *> transfers_t;
+
+    // Extra connection of a striped session, carrying only bulk chunks
+    struct lane_t {
+        Client *_client;
+        int _socket;
+        pthread_t _reader;
+        pthread_mutex_t _mutex;
+        int _start, _end;
+        unsigned char _buffer[__lane_buffer_size];
+    };
+
+    bool _verbose, _parallel, _frame_pending, _input_closed, _socket_readable, _direct_read, _compact, _compress, _resume, _delta, _streams, _folders, _verify, _preallocate, _headless;
+    int _port, _socket, _control_fd, _input_fd, _epoll_fd, _wake_fd, _timer_fd, _batch_fd, _batch_window, _server_flags, _frame_received, _frame_size, _frame_flags, _header_size, _recv_start, _recv_end, _group, _cipher, _features, _queue_depth, _crypto_threads, _file_io, _file_workers, _ticket_ttl, _connections;
+    unsigned int _frame_stream, _next_stream, _peer_stream;
+    size_t _next_lane;
+    std::atomic<long> _raw_blocks;
+    unsigned char *_recv_buffer, *_frame_data;
+    std::string _config_path, _name, _server, _file_path, _command_path, _control_path, _peer_name, _input, _batch;
+    std::vector<std::string> _accept_rules;
     time_t _time;
-    pthread_t _terminal_listener, _network_listener, _keepalive_sender;
-    pthread_cond_t _cond;
-    pthread_mutex_t _mutex;
-    block_t _block;
+    block_t::cmd_t _frame_cmd;
+    pthread_t _event_loop;
+    pthread_mutex_t _send_mutex, _seal_mutex, _transfer_mutex;
+    std::atomic<bool> _blocked, _handshaking, _frame_wanted, _disconnected;
+    std::atomic<int> _waiting;
+    std::atomic<unsigned int> _events;
+    Queue *_network_queue, *_terminal_queue;
+    transfers_t _transfers;
+    std::deque<transfer_t *> _offers;
+    std::vector<lane_t *> _lanes;
+    std::set<unsigned int> _skipped_streams;
+    block_t _frame, _plain;
     Crypto _crypto;
+    Tickets _tickets;
+    Scheduler _scheduler;
 
+    int dial();
+    void wait_for_peer();
+    void list_peers(peers_t &peers);
+    void connect_to_peer(const std::pair<int, std::string> &peer);
+    void find_peer(const std::string &name);
+    void handshake(bool initiator);
+    void open_lanes(bool initiator);
+    int probe_connections();
+    void *lane_reader(lane_t &lane);
+    bool fill_lane(lane_t &lane);
+    lane_t *pick_lane();
     void shell();
-    void *terminal_listener();
-    void *network_listener();
-    void *keepalive_sender();
+    void run_command(const std::string &line);
+    void process_block(block_t &block);
+    void offer_file(const std::string &file_path);
+    void say(const std::string &line);
+    bool is_accepted(const std::string &file_name);
+    void wait_for_transfers();
+    void disconnect();
+    void accept_control();
+    void *event_loop();
+    void read_terminal();
+    bool read_frame();
+    bool deliver_frame();
+    bool deliver_line();
+    void watch(int fd, bool enable);
+    void wake();
+    void wait_for(bool network, bool terminal);
+    void notify();
+    void notify(transfer_t &transfer);
+    void send_file(transfer_t &transfer);
+    void recv_file(transfer_t &transfer, const std::string &file_name);
+    void *sender(transfer_t &transfer);
+    void *receiver(transfer_t &transfer);
+    void *file_reader(transfer_t &transfer);
+    void *block_encrypter(transfer_t &transfer);
+    void *file_writer(transfer_t &transfer);
+    transfer_t *find_transfer(unsigned int stream);
+    void close_transfer(transfer_t *transfer);
     void get_string(std::string &dest);
     void send_block(const block_t &source);
+    void send_block(transfer_t &transfer, block_t block);
+    bool write_block(const block_t &source, int flags);
+    bool write_chunk(lane_t *lane, const block_t &source, unsigned long index);
+    bool send_chunk(transfer_t &transfer, block_t &block);
+    void flush_blocks();
+    bool write_all(int socket, iovec *iov, int count);
+    bool read_all(int socket, void *data, int size);
+    void lane_send(int socket, const block_t &source);
+    void lane_recv(int socket, block_t &dest);
+    int put_header(unsigned char *dest, const block_t &source, int flags);
+    int get_header(const unsigned char *source, int size);
+    void cork(bool enable);
     void recv_block(block_t &dest);
+    void recv_block(transfer_t &transfer, block_t &dest);
+    void recv_chunk(transfer_t &transfer, block_t &dest);
+    bool has_block(transfer_t &transfer) const;
+    void wait_for(transfer_t &transfer);
     std::string trim_path(std::string path);
     std::string format_size(long bytes);
     std::string format_time(long seconds);
+    void send_records(transfer_t &transfer, const std::vector<std::string> &records, int record_size);
+    void recv_records(transfer_t &transfer, std::vector<std::string> &records, int record_size);
+    void send_string(transfer_t &transfer, const std::string &data);
+    void recv_string(transfer_t &transfer, std::string &data);
+    long match_chunks(transfer_t &transfer, const std::vector<std::string> &hashes);
+    void send_delta(transfer_t &transfer, const std::vector<std::string> &signatures, long file_size);
+    void recv_delta(transfer_t &transfer, long file_size, const std::vector<Chunker::chunk_t> &base_chunks);
+    void print_summary(const std::string &action, long file_size, long wire_bytes, const timespec &start_time);
 
 };
 
@@ -0,0 +1,107 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "compressor.h"
+
+Compressor::Compressor() {
+    _level = __compress_level_min;
+    memset(&_deflate, 0, sizeof _deflate);
+    memset(&_inflate, 0, sizeof _inflate);
+    if (deflateInit2(&_deflate, _level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        throw std::runtime_error("can't initialize compression");
+    if (inflateInit2(&_inflate, -MAX_WBITS) != Z_OK) {
+        deflateEnd(&_deflate);
+        throw std::runtime_error("can't initialize decompression");
+    }
+}
+
+Compressor::~Compressor() {
+    deflateEnd(&_deflate);
+    inflateEnd(&_inflate);
+}
+
+void Compressor::compress(block_t &dest, const block_t &source) {
+
+    int size;
+
+    dest._cmd = source._cmd;
+    dest.reserve(source._size + 1);
+    if (is_compressible(source._data, source._size)) {
+        deflateReset(&_deflate);
+        deflateParams(&_deflate, _level, Z_DEFAULT_STRATEGY);
+        _deflate.next_in = source._data;
+        _deflate.avail_in = source._size;
+        _deflate.next_out = dest._data + 1;
+        _deflate.avail_out = source._size;
+        if (deflate(&_deflate, Z_FINISH) == Z_STREAM_END) {
+            size = source._size - _deflate.avail_out;
+            if (size * 4 < source._size && _level < __compress_level_max)
+                _level++;
+            else if (size * 4 > source._size * 3 && _level > __compress_level_min)
+                _level = __compress_level_min;
+            dest._data[0] = __compress_deflate;
+            dest._size = size + 1;
+            return;
+        }
+        _level = __compress_level_min;
+    }
+    dest._data[0] = __compress_raw;
+    memcpy(dest._data + 1, source._data, source._size);
+    dest._size = source._size + 1;
+}
+
+void Compressor::decompress(block_t &dest, const block_t &source) {
+
+    int result;
+
+    if (source._size < 1)
+        throw std::runtime_error("malformed block received");
+    dest._cmd = source._cmd;
+    if (source._data[0] == __compress_raw) {
+        dest.reserve(source._size - 1);
+        memcpy(dest._data, source._data + 1, source._size - 1);
+        dest._size = source._size - 1;
+        return;
+    }
+    if (source._data[0] != __compress_deflate)
+        throw std::runtime_error("malformed block received");
+    dest.reserve(__data_size);
+    inflateReset(&_inflate);
+    _inflate.next_in = source._data + 1;
+    _inflate.avail_in = source._size - 1;
+    _inflate.next_out = dest._data;
+    _inflate.avail_out = __data_size;
+    result = inflate(&_inflate, Z_FINISH);
+    if (result != Z_STREAM_END || _inflate.avail_in)
+        throw std::runtime_error("can't decompress block");
+    dest._size = __data_size - _inflate.avail_out;
+}
+
+bool Compressor::is_compressible(const unsigned char *data, int size) {
+
+    int counts[256] = {0}, samples = 0, stride = size > __compress_samples ? size / __compress_samples : 1;
+    double entropy = 0, probability;
+
+    for (int i = 0; i < size; i += stride, samples++)
+        counts[data[i]]++;
+    if (samples < 64)
+        return true;
+    for (int i = 0; i < 256; i++)
+        if (counts[i]) {
+            probability = (double) counts[i] / samples;
+            entropy -= probability * log2(probability);
+        }
+    return entropy < __compress_entropy;
+}
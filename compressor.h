@@ -0,0 +1,57 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef compressor_h
+#define	compressor_h
+
+#include <zlib.h>
+#include <math.h>
+#include <stdexcept>
+#include "crypto.h"
+
+#define __compress_raw      0
+#define __compress_deflate  1
+#define __compress_level_min    1
+#define __compress_level_max    6
+#define __compress_samples  4096
+#define __compress_entropy  7.5
+
+/*
+  Per chunk deflate for file transfers. Each chunk is compressed on its own
+  so chunks can be handled by any worker and in any order, and carries a
+  one byte prefix saying whether it is deflated or stored. Chunks whose
+  sampled byte entropy says they are already compressed are stored without
+  trying, and the level climbs while chunks keep shrinking well and drops
+  back to the fastest level when they don't.
+ */
+class Compressor {
+public:
+
+    Compressor();
+    ~Compressor();
+
+    void compress(block_t &dest, const block_t &source);
+    void decompress(block_t &dest, const block_t &source);
+
+    static bool is_compressible(const unsigned char *data, int size);
+
+private:
+
+    int _level;
+    z_stream _deflate, _inflate;
+
+};
+
+#endif
@@ -15,34 +15,172 @@
 
 #include "crypto.h"
 
+std::string Crypto::_groups_path;
+DH *Crypto::_groups[__groups];
+
 Crypto::Crypto() {
-    _ready = false;
+    _ready = _initiator = false;
+    _cipher = __cipher_cbc;
+    _send_counter = _recv_counter = 0;
+    _send_transfers = _recv_transfers = 0;
     _dh = DH_new();
     _pub_key = BN_new();
-    EVP_CIPHER_CTX_init(&_encryption_ctx);
-    EVP_CIPHER_CTX_init(&_decryption_ctx);
-    HMAC_CTX_init(&_hmac_ctx);
+    _pkey = NULL;
+    _encryption_ctx = EVP_CIPHER_CTX_new();
+    _decryption_ctx = EVP_CIPHER_CTX_new();
+    _hmac_ctx = HMAC_CTX_new();
+    _verify_ctx = HMAC_CTX_new();
 }
 
 Crypto::~Crypto() {
     DH_free(_dh);
     BN_free(_pub_key);
-    EVP_CIPHER_CTX_cleanup(&_encryption_ctx);
-    EVP_CIPHER_CTX_cleanup(&_decryption_ctx);
-    HMAC_CTX_cleanup(&_hmac_ctx);
-    memset(_key, 0, __key_size);
+    EVP_PKEY_free(_pkey);
+    EVP_CIPHER_CTX_free(_encryption_ctx);
+    EVP_CIPHER_CTX_free(_decryption_ctx);
+    HMAC_CTX_free(_hmac_ctx);
+    HMAC_CTX_free(_verify_ctx);
+    OPENSSL_cleanse(_key, __key_size);
+}
+
+void Crypto::load_groups(const std::string &path) {
+
+    FILE *file;
+    BIGNUM *p, *g;
+
+    _groups_path = path;
+    _groups[__group_ffdhe2048] = DH_new_by_nid(NID_ffdhe2048);
+    _groups[__group_ffdhe3072] = DH_new_by_nid(NID_ffdhe3072);
+    p = BN_get_rfc3526_prime_2048(NULL);
+    g = BN_new();
+    BN_set_word(g, 2);
+    _groups[__group_modp2048] = DH_new();
+    DH_set0_pqg(_groups[__group_modp2048], p, NULL, g);
+    DH_set_length(_groups[__group_modp2048], 2 * 112);
+    file = fopen(path.c_str(), "r");
+    if (file) {
+        _groups[__group_local] = PEM_read_DHparams(file, NULL, NULL, NULL);
+        fclose(file);
+    }
+}
+
+int Crypto::group_id(const std::string &name) {
+    if (name == "local")
+        return __group_local;
+    if (name == "ffdhe2048")
+        return __group_ffdhe2048;
+    if (name == "ffdhe3072")
+        return __group_ffdhe3072;
+    if (name == "modp2048")
+        return __group_modp2048;
+    throw std::runtime_error("unknown key exchange group " + name);
+}
+
+std::string Crypto::group_name(int id) {
+    switch (id) {
+        case __group_local:
+            return "local";
+        case __group_ffdhe2048:
+            return "ffdhe2048";
+        case __group_ffdhe3072:
+            return "ffdhe3072";
+        case __group_modp2048:
+            return "modp2048";
+    }
+    throw std::runtime_error("unknown key exchange group");
+}
+
+int Crypto::cipher_id(const std::string &name) {
+    if (name == "auto")
+        return __cipher_auto;
+    if (name == "aes-256-cbc")
+        return __cipher_cbc;
+    if (name == "aes-256-gcm")
+        return __cipher_aes_gcm;
+    if (name == "chacha20-poly1305")
+        return __cipher_chacha20;
+    throw std::runtime_error("unknown cipher " + name);
+}
+
+std::string Crypto::cipher_name(int id) {
+    switch (id) {
+        case __cipher_auto:
+            return "auto";
+        case __cipher_cbc:
+            return "aes-256-cbc";
+        case __cipher_aes_gcm:
+            return "aes-256-gcm";
+        case __cipher_chacha20:
+            return "chacha20-poly1305";
+    }
+    throw std::runtime_error("unknown cipher");
+}
+
+DH *Crypto::local_group() {
+
+    FILE *file;
+
+    if (!_groups[__group_local]) {
+        _groups[__group_local] = DH_new();
+        if (!DH_generate_parameters_ex(_groups[__group_local], __prime_length, 5, NULL))
+            throw std::runtime_error("can't generate key exchange parameters");
+        file = fopen(_groups_path.c_str(), "w");
+        if (file) {
+            PEM_write_DHparams(file, _groups[__group_local]);
+            fclose(file);
+        }
+    }
+    return _groups[__group_local];
 }
 
-void Crypto::get_prime(block_t &dest) {
-    DH_generate_parameters_ex(_dh, __key_length, 5, NULL);
-    dest = block_t(block_t::data, BN_num_bytes(_dh->p));
-    BN_bn2bin(_dh->p, dest._data);
+void Crypto::get_group(block_t &dest, int id) {
+
+    int size = 0;
+    const BIGNUM *p = NULL, *g = NULL;
+
+    if (id < 0 || id >= __groups || (id != __group_local && !_groups[id]))
+        throw std::runtime_error("unsupported key exchange group");
+    DH_free(_dh);
+    if (id == __group_local) {
+        _dh = DHparams_dup(local_group());
+        DH_get0_pqg(_dh, &p, NULL, &g);
+        size = BN_num_bytes(p);
+    } else
+        _dh = DHparams_dup(_groups[id]);
+    dest = block_t(block_t::data, sizeof id + (p ? sizeof size + size + BN_num_bytes(g) : 0));
+    memcpy(dest._data, &id, sizeof id);
+    if (p) {
+        memcpy(dest._data + sizeof id, &size, sizeof size);
+        BN_bn2bin(p, dest._data + sizeof id + sizeof size);
+        BN_bn2bin(g, dest._data + sizeof id + sizeof size + size);
+    }
 }
 
 void Crypto::get_public_key(block_t &dest) {
+
+    const BIGNUM *pub_key;
+
     DH_generate_key(_dh);
-    dest = block_t(block_t::data, BN_num_bytes(_dh->pub_key));
-    BN_bn2bin(_dh->pub_key, dest._data);
+    DH_get0_key(_dh, &pub_key, NULL);
+    dest = block_t(block_t::data, BN_num_bytes(pub_key));
+    BN_bn2bin(pub_key, dest._data);
+}
+
+void Crypto::get_ecdh_key(block_t &dest) {
+
+    size_t size = __ecdh_key_size;
+    EVP_PKEY_CTX *ctx;
+
+    ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_X25519, NULL);
+    EVP_PKEY_free(_pkey);
+    _pkey = NULL;
+    if (!ctx || EVP_PKEY_keygen_init(ctx) <= 0 || EVP_PKEY_keygen(ctx, &_pkey) <= 0) {
+        EVP_PKEY_CTX_free(ctx);
+        throw std::runtime_error("can't generate key pair");
+    }
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_get_raw_public_key(_pkey, _ecdh_key, &size);
+    dest = block_t(block_t::data, _ecdh_key, __ecdh_key_size);
 }
 
 void Crypto::get_init_vector(block_t &dest) {
@@ -50,54 +188,338 @@ void Crypto::get_init_vector(block_t &dest) {
     RAND_bytes(dest._data, __iv_size);
 }
 
-void Crypto::set_prime(const block_t &source) {
-    DH_generate_parameters_ex(_dh, __key_length, 5, NULL);
-    BN_bin2bn(source._data, source._size, _dh->p);
+void Crypto::set_group(const block_t &source) {
+
+    int id, size, codes;
+    const int header = sizeof id + sizeof size;
+    BIGNUM *p, *g;
+    DH *dh;
+
+    if (source._size < (int) sizeof id)
+        throw std::runtime_error("invalid key exchange group");
+    memcpy(&id, source._data, sizeof id);
+    if (id == __group_local) {
+        // The local group travels with its generator, which need not be the
+        // one local_group() generates with
+        if (source._size <= header)
+            throw std::runtime_error("invalid key exchange group");
+        memcpy(&size, source._data + sizeof id, sizeof size);
+        if (size <= 0 || size >= source._size - header)
+            throw std::runtime_error("invalid key exchange group");
+        p = BN_bin2bn(source._data + header, size, NULL);
+        g = BN_bin2bn(source._data + header + size, source._size - header - size, NULL);
+        dh = DH_new();
+        DH_set0_pqg(dh, p, NULL, g);
+        if (!DH_check_params(dh, &codes) || codes) {
+            DH_free(dh);
+            throw std::runtime_error("invalid key exchange group");
+        }
+    } else if (id < 0 || id >= __groups || !_groups[id])
+        throw std::runtime_error("unsupported key exchange group");
+    else
+        dh = DHparams_dup(_groups[id]);
+    DH_free(_dh);
+    _dh = dh;
 }
 
 void Crypto::set_public_key(const block_t &source) {
+
+    bool ok;
+    int codes, size = DH_size(_dh);
+    unsigned char *secret;
+    const BIGNUM *pub_key;
+    std::string local_key;
+
     BN_bin2bn(source._data, source._size, _pub_key);
-    DH_compute_key(_key, _pub_key, _dh);
-    SHA256_Init(&_sha256_ctx);
-    SHA256_Update(&_sha256_ctx, _key, __key_size);
-    SHA256_Final(_key, &_sha256_ctx);
+    if (!DH_check_pub_key(_dh, _pub_key, &codes) || codes)
+        throw std::runtime_error("invalid peer public key");
+    secret = new unsigned char[size];
+    if (DH_compute_key_padded(secret, _pub_key, _dh) != size) {
+        delete[] secret;
+        throw std::runtime_error("can't compute shared secret");
+    }
+    DH_get0_key(_dh, &pub_key, NULL);
+    local_key.resize(BN_num_bytes(pub_key));
+    BN_bn2bin(pub_key, (unsigned char *) &local_key[0]);
+    ok = set_session_key(secret, size, "dh", local_key, std::string((char *) source._data, source._size));
+    OPENSSL_cleanse(secret, size);
+    delete[] secret;
+    if (!ok)
+        throw std::runtime_error("can't derive session key");
+}
+
+void Crypto::set_ecdh_key(const block_t &source) {
+
+    bool ok;
+    size_t size = __ecdh_key_size;
+    unsigned char secret[__ecdh_key_size];
+    EVP_PKEY *peer_key;
+    EVP_PKEY_CTX *ctx;
+
+    if (source._size != __ecdh_key_size || !_pkey)
+        throw std::runtime_error("invalid peer public key");
+    peer_key = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, source._data, __ecdh_key_size);
+    ctx = EVP_PKEY_CTX_new(_pkey, NULL);
+    ok = peer_key && ctx && EVP_PKEY_derive_init(ctx) > 0 && EVP_PKEY_derive_set_peer(ctx, peer_key) > 0 && EVP_PKEY_derive(ctx, secret, &size) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peer_key);
+    if (!ok)
+        throw std::runtime_error("can't compute shared secret");
+    ok = set_session_key(secret, __ecdh_key_size, "x25519", std::string((char *) _ecdh_key, __ecdh_key_size), std::string((char *) source._data, __ecdh_key_size));
+    OPENSSL_cleanse(secret, __ecdh_key_size);
+    if (!ok)
+        throw std::runtime_error("can't derive session key");
 }
 
 void Crypto::set_init_vector(const block_t &source) {
+
+    const EVP_CIPHER *cipher = get_cipher();
+
     memcpy(_iv, source._data, __iv_size);
+    memcpy(_recv_iv, source._data, __iv_size);
+    if (!EVP_EncryptInit_ex(_encryption_ctx, cipher, NULL, _key, NULL) || !EVP_DecryptInit_ex(_decryption_ctx, cipher, NULL, _key, NULL))
+        throw std::runtime_error("can't initialize cipher");
+    HMAC_Init_ex(_hmac_ctx, _key, __key_size, EVP_sha1(), NULL);
+    HMAC_Init_ex(_verify_ctx, _key, __key_size, EVP_sha1(), NULL);
+    _send_counter = _recv_counter = 0;
     _ready = true;
 }
 
-void Crypto::encrypt_block(block_t &dest, const block_t &source) {
+void Crypto::resume_session(const std::string &secret, const std::string &salt) {
+
+    unsigned char keys[__key_size + __iv_size];
+    block_t iv;
+
+    if (!derive(keys, sizeof keys, (const unsigned char *) secret.data(), secret.size(), (const unsigned char *) salt.data(), salt.size(), (const unsigned char *) "resume", 6))
+        throw std::runtime_error("can't derive session key");
+    memcpy(_key, keys, __key_size);
+    iv = block_t(block_t::data, keys + __key_size, __iv_size);
+    OPENSSL_cleanse(keys, sizeof keys);
+    set_init_vector(iv);
+}
 
-    int padding;
+std::string Crypto::get_ticket() const {
 
+    unsigned char secret[__ticket_size];
+    std::string ticket;
+
+    if (!derive(secret, sizeof secret, _key, __key_size, (const unsigned char *) "SafeChat", 8, (const unsigned char *) "ticket", 6))
+        throw std::runtime_error("can't derive session ticket");
+    ticket = std::string((char *) secret, sizeof secret);
+    OPENSSL_cleanse(secret, sizeof secret);
+    return ticket;
+}
+
+std::string Crypto::bind_ticket(const std::string &secret, const unsigned char *nonce, int size) {
+
+    unsigned char binder[SHA256_DIGEST_LENGTH];
+    unsigned int length = sizeof binder;
+
+    HMAC(EVP_sha256(), secret.data(), secret.size(), nonce, size, binder, &length);
+    return std::string((char *) binder, length);
+}
+
+void Crypto::set_cipher(int cipher, bool initiator) {
+    _cipher = cipher;
+    _initiator = initiator;
+}
+
+void Crypto::encrypt_block(block_t &dest, const block_t &source, int flags) {
+
+    int size;
+    unsigned char nonce[__nonce_size], flags_byte = flags;
+    timespec start;
+
+    Metrics::begin(start);
     dest._cmd = source._cmd;
-    EVP_EncryptInit_ex(&_encryption_ctx, EVP_aes_256_cbc(), NULL, _key, _iv);
-    EVP_EncryptUpdate(&_encryption_ctx, dest._data, &dest._size, source._data, source._size);
-    EVP_EncryptFinal_ex(&_encryption_ctx, dest._data + dest._size, &padding);
-    memcpy(_iv, _encryption_ctx.iv, __iv_size);
-    dest._size += padding;
-    HMAC_Init_ex(&_hmac_ctx, _key, __key_size, EVP_sha1(), NULL);
-    HMAC_Update(&_hmac_ctx, dest._data, dest._size);
-    HMAC_Final(&_hmac_ctx, dest._data + dest._size, NULL);
-    dest._size += __hmac_size;
+    dest._stream = source._stream;
+    if (_cipher == __cipher_cbc) {
+        dest.reserve(source._size + AES_BLOCK_SIZE + __hmac_size);
+        EVP_EncryptInit_ex(_encryption_ctx, NULL, NULL, NULL, _iv);
+        EVP_EncryptUpdate(_encryption_ctx, dest._data, &dest._size, source._data, source._size);
+        EVP_EncryptFinal_ex(_encryption_ctx, dest._data + dest._size, &size);
+        dest._size += size;
+        memcpy(_iv, dest._data + dest._size - __iv_size, __iv_size);
+        HMAC_Init_ex(_hmac_ctx, NULL, 0, NULL, NULL);
+        if (flags)
+            HMAC_Update(_hmac_ctx, &flags_byte, sizeof flags_byte);
+        HMAC_Update(_hmac_ctx, dest._data, dest._size);
+        HMAC_Final(_hmac_ctx, dest._data + dest._size, NULL);
+        dest._size += __hmac_size;
+        Metrics::end(__metric_encrypt_ns, start);
+        return;
+    }
+    dest.reserve(source._size + __tag_size);
+    get_nonce(nonce, _send_counter++, _initiator);
+    EVP_EncryptInit_ex(_encryption_ctx, NULL, NULL, NULL, nonce);
+    EVP_EncryptUpdate(_encryption_ctx, NULL, &size, (const unsigned char *) &source._cmd, sizeof source._cmd);
+    if (source._stream)
+        EVP_EncryptUpdate(_encryption_ctx, NULL, &size, (const unsigned char *) &source._stream, sizeof source._stream);
+    if (flags)
+        EVP_EncryptUpdate(_encryption_ctx, NULL, &size, &flags_byte, sizeof flags_byte);
+    EVP_EncryptUpdate(_encryption_ctx, dest._data, &dest._size, source._data, source._size);
+    EVP_EncryptFinal_ex(_encryption_ctx, dest._data + dest._size, &size);
+    dest._size += size;
+    EVP_CIPHER_CTX_ctrl(_encryption_ctx, EVP_CTRL_AEAD_GET_TAG, __tag_size, dest._data + dest._size);
+    dest._size += __tag_size;
+    Metrics::end(__metric_encrypt_ns, start);
 }
 
 void Crypto::decrypt_block(block_t &dest, const block_t &source) {
+    decrypt_block(dest, source._cmd, source._stream, 0, source._data, source._size);
+}
+
+void Crypto::decrypt_block(block_t &dest, block_t::cmd_t cmd, unsigned int stream, int flags, const unsigned char *data, int size) {
 
-    int padding, data_size = source._size - __hmac_size;
-    unsigned char hmac[__hmac_size];
+    int final_size, data_size;
+    unsigned char hmac[__hmac_size], nonce[__nonce_size], flags_byte = flags;
+    timespec start;
 
-    HMAC_Init_ex(&_hmac_ctx, _key, __key_size, EVP_sha1(), NULL);
-    HMAC_Update(&_hmac_ctx, source._data, data_size);
-    HMAC_Final(&_hmac_ctx, hmac, NULL);
-    if (memcmp(hmac, source._data + data_size, __hmac_size))
+    Metrics::begin(start);
+    if (_cipher == __cipher_cbc) {
+        data_size = size - __hmac_size;
+        if (data_size < __iv_size || data_size % AES_BLOCK_SIZE)
+            throw std::runtime_error("malformed block received");
+        HMAC_Init_ex(_verify_ctx, NULL, 0, NULL, NULL);
+        if (flags)
+            HMAC_Update(_verify_ctx, &flags_byte, sizeof flags_byte);
+        HMAC_Update(_verify_ctx, data, data_size);
+        HMAC_Final(_verify_ctx, hmac, NULL);
+        if (CRYPTO_memcmp(hmac, data + data_size, __hmac_size))
+            throw std::runtime_error("can't authenticate block");
+        dest._cmd = cmd;
+        dest._stream = stream;
+        dest.reserve(data_size);
+        EVP_DecryptInit_ex(_decryption_ctx, NULL, NULL, NULL, _recv_iv);
+        EVP_DecryptUpdate(_decryption_ctx, dest._data, &dest._size, data, data_size);
+        if (!EVP_DecryptFinal_ex(_decryption_ctx, dest._data + dest._size, &final_size))
+            throw std::runtime_error("can't decrypt block");
+        memcpy(_recv_iv, data + data_size - __iv_size, __iv_size);
+        dest._size += final_size;
+        Metrics::end(__metric_decrypt_ns, start);
+        return;
+    }
+    data_size = size - __tag_size;
+    if (data_size < 0)
+        throw std::runtime_error("malformed block received");
+    dest._cmd = cmd;
+    dest._stream = stream;
+    dest.reserve(data_size);
+    get_nonce(nonce, _recv_counter++, !_initiator);
+    EVP_DecryptInit_ex(_decryption_ctx, NULL, NULL, NULL, nonce);
+    EVP_DecryptUpdate(_decryption_ctx, NULL, &final_size, (const unsigned char *) &cmd, sizeof cmd);
+    if (stream)
+        EVP_DecryptUpdate(_decryption_ctx, NULL, &final_size, (const unsigned char *) &stream, sizeof stream);
+    if (flags)
+        EVP_DecryptUpdate(_decryption_ctx, NULL, &final_size, &flags_byte, sizeof flags_byte);
+    EVP_DecryptUpdate(_decryption_ctx, dest._data, &dest._size, data, data_size);
+    EVP_CIPHER_CTX_ctrl(_decryption_ctx, EVP_CTRL_AEAD_SET_TAG, __tag_size, (void *) (data + data_size));
+    if (EVP_DecryptFinal_ex(_decryption_ctx, dest._data + dest._size, &final_size) <= 0)
         throw std::runtime_error("can't authenticate block");
+    dest._size += final_size;
+    Metrics::end(__metric_decrypt_ns, start);
+}
+
+int Crypto::begin_transfer(bool sending) {
+    if (sending)
+        return _send_transfers++;
+    return _recv_transfers++;
+}
+
+void Crypto::encrypt_chunk(block_t &dest, const block_t &source, int transfer, unsigned long index) const {
+
+    bool ok;
+    int size;
+    unsigned char nonce[__nonce_size];
+    timespec start;
+    EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+
+    Metrics::begin(start);
     dest._cmd = source._cmd;
-    EVP_DecryptInit_ex(&_decryption_ctx, EVP_aes_256_cbc(), NULL, _key, _iv);
-    EVP_DecryptUpdate(&_decryption_ctx, dest._data, &dest._size, source._data, data_size);
-    EVP_DecryptFinal_ex(&_decryption_ctx, dest._data + dest._size, &padding);
-    memcpy(_iv, _decryption_ctx.iv, __iv_size);
-    dest._size += padding;
+    dest._stream = source._stream;
+    dest.reserve(source._size + __tag_size);
+    get_chunk_nonce(nonce, transfer, index, _initiator);
+    ok = ctx && EVP_EncryptInit_ex(ctx, get_cipher(), NULL, _key, nonce) &&
+            EVP_EncryptUpdate(ctx, NULL, &size, (const unsigned char *) &source._cmd, sizeof source._cmd) &&
+            EVP_EncryptUpdate(ctx, dest._data, &dest._size, source._data, source._size) &&
+            EVP_EncryptFinal_ex(ctx, dest._data + dest._size, &size) &&
+            EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, __tag_size, dest._data + dest._size + size);
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok)
+        throw std::runtime_error("can't encrypt block");
+    dest._size += size + __tag_size;
+    Metrics::end(__metric_encrypt_ns, start);
+}
+
+void Crypto::decrypt_chunk(block_t &dest, const block_t &source, int transfer, unsigned long index) const {
+
+    bool ok;
+    int size, data_size = source._size - __tag_size;
+    unsigned char nonce[__nonce_size];
+    timespec start;
+    EVP_CIPHER_CTX *ctx;
+
+    Metrics::begin(start);
+    if (data_size < 0)
+        throw std::runtime_error("malformed block received");
+    ctx = EVP_CIPHER_CTX_new();
+    dest._cmd = source._cmd;
+    dest._stream = source._stream;
+    dest.reserve(data_size);
+    get_chunk_nonce(nonce, transfer, index, !_initiator);
+    ok = ctx && EVP_DecryptInit_ex(ctx, get_cipher(), NULL, _key, nonce) &&
+            EVP_DecryptUpdate(ctx, NULL, &size, (const unsigned char *) &source._cmd, sizeof source._cmd) &&
+            EVP_DecryptUpdate(ctx, dest._data, &dest._size, source._data, data_size) &&
+            EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, __tag_size, source._data + data_size) &&
+            EVP_DecryptFinal_ex(ctx, dest._data + dest._size, &size) > 0;
+    EVP_CIPHER_CTX_free(ctx);
+    if (!ok)
+        throw std::runtime_error("can't authenticate block");
+    dest._size += size;
+    Metrics::end(__metric_decrypt_ns, start);
+}
+
+const EVP_CIPHER *Crypto::get_cipher() const {
+    if (_cipher == __cipher_aes_gcm)
+        return EVP_aes_256_gcm();
+    if (_cipher == __cipher_chacha20)
+        return EVP_chacha20_poly1305();
+    return EVP_aes_256_cbc();
+}
+
+bool Crypto::set_session_key(const unsigned char *secret, int size, const std::string &label, const std::string &local_key, const std::string &peer_key) {
+
+    std::string info = label + ":";
+
+    // Bind the key to both public keys, ordered so each side builds the same info
+    info += local_key < peer_key ? local_key + peer_key : peer_key + local_key;
+    return derive(_key, __key_size, secret, size, (const unsigned char *) "SafeChat", 8, (const unsigned char *) info.data(), info.size());
+}
+
+bool Crypto::derive(unsigned char *dest, size_t size, const unsigned char *key, int key_size, const unsigned char *salt, int salt_size, const unsigned char *info, int info_size) {
+
+    bool ok;
+    EVP_PKEY_CTX *ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, NULL);
+
+    ok = ctx && EVP_PKEY_derive_init(ctx) > 0 && EVP_PKEY_CTX_set_hkdf_md(ctx, EVP_sha256()) > 0 &&
+            EVP_PKEY_CTX_set1_hkdf_salt(ctx, salt, salt_size) > 0 &&
+            EVP_PKEY_CTX_set1_hkdf_key(ctx, key, key_size) > 0 &&
+            EVP_PKEY_CTX_add1_hkdf_info(ctx, info, info_size) > 0 && EVP_PKEY_derive(ctx, dest, &size) > 0;
+    EVP_PKEY_CTX_free(ctx);
+    return ok;
+}
+
+void Crypto::get_nonce(unsigned char *dest, unsigned long counter, bool initiator) const {
+    memcpy(dest, _iv, __nonce_size);
+    if (!initiator)
+        dest[0] ^= 0x80;
+    for (int i = __nonce_size - 1; counter; i--, counter >>= 8)
+        dest[i] ^= counter & 0xff;
+}
+
+void Crypto::get_chunk_nonce(unsigned char *dest, int transfer, unsigned long index, bool initiator) const {
+    get_nonce(dest, index, initiator);
+    dest[0] ^= 0x40;
+    for (int i = 3; i > 0; i--, transfer >>= 8)
+        dest[i] ^= transfer & 0xff;
 }
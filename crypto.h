@@ -16,52 +16,111 @@
 #ifndef crypto_h
 #define	crypto_h
 
+#include <string>
+#include <atomic>
 #include <stdexcept>
 #include <openssl/dh.h>
 #include <openssl/bn.h>
 #include <openssl/aes.h>
 #include <openssl/sha.h>
 #include <openssl/evp.h>
+#include <openssl/pem.h>
 #include <openssl/hmac.h>
+#include <openssl/kdf.h>
 #include <openssl/rand.h>
+#include <openssl/objects.h>
 #include "block.h"
+#include "metrics.h"
 
 #define __key_length    256
 #define __key_size      __key_length / 8
+#define __prime_length  2048
 #define __iv_size       AES_BLOCK_SIZE
 #define __hmac_size     SHA_DIGEST_LENGTH
+#define __nonce_size    12
+#define __tag_size      16
 #define __data_size     __block_size - AES_BLOCK_SIZE - __hmac_size
 
+#define __group_local       0
+#define __group_ffdhe2048   1
+#define __group_ffdhe3072   2
+#define __group_modp2048    3
+#define __groups            4
+
+#define __ecdh_key_size     32
+#define __ticket_size       32
+
+#define __cipher_auto       -1
+#define __cipher_cbc        0
+#define __cipher_aes_gcm    1
+#define __cipher_chacha20   2
+
 class Crypto {
 public:
 
     Crypto();
     ~Crypto();
 
-    void get_prime(block_t &dest);
+    static void load_groups(const std::string &path);
+    static int group_id(const std::string &name);
+    static std::string group_name(int id);
+    static int cipher_id(const std::string &name);
+    static std::string cipher_name(int id);
+
+    void get_group(block_t &dest, int id);
     void get_public_key(block_t &dest);
+    void get_ecdh_key(block_t &dest);
     void get_init_vector(block_t &dest);
 
-    void set_prime(const block_t &source);
+    void set_group(const block_t &source);
     void set_public_key(const block_t &source);
+    void set_ecdh_key(const block_t &source);
     void set_init_vector(const block_t &source);
+    void set_cipher(int cipher, bool initiator);
 
-    void encrypt_block(block_t &dest, const block_t &source);
+    void encrypt_block(block_t &dest, const block_t &source, int flags = 0);
     void decrypt_block(block_t &dest, const block_t &source);
+    void decrypt_block(block_t &dest, block_t::cmd_t cmd, unsigned int stream, int flags, const unsigned char *data, int size);
+
+    void resume_session(const std::string &secret, const std::string &salt);
+    std::string get_ticket() const;
+    static std::string bind_ticket(const std::string &secret, const unsigned char *nonce, int size);
+
+    int begin_transfer(bool sending);
+    void encrypt_chunk(block_t &dest, const block_t &source, int transfer, unsigned long index) const;
+    void decrypt_chunk(block_t &dest, const block_t &source, int transfer, unsigned long index) const;
 
     bool is_ready() const {
         return _ready;
     }
 
+    bool is_parallel() const {
+        return _ready && _cipher != __cipher_cbc;
+    }
+
 private:
 
-    bool _ready;
-    unsigned char _key[__key_size], _iv[__iv_size];
+    static std::string _groups_path;
+    static DH *_groups[__groups];
+
+    std::atomic<bool> _ready;
+    bool _initiator;
+    int _cipher, _send_transfers, _recv_transfers;
+    unsigned long _send_counter, _recv_counter;
+    unsigned char _key[__key_size], _iv[__iv_size], _recv_iv[__iv_size], _ecdh_key[__ecdh_key_size];
     DH *_dh;
     BIGNUM *_pub_key;
-    SHA256_CTX _sha256_ctx;
-    EVP_CIPHER_CTX _encryption_ctx, _decryption_ctx;
-    HMAC_CTX _hmac_ctx;
+    EVP_PKEY *_pkey;
+    EVP_CIPHER_CTX *_encryption_ctx, *_decryption_ctx;
+    HMAC_CTX *_hmac_ctx, *_verify_ctx;
+
+    static DH *local_group();
+    bool set_session_key(const unsigned char *secret, int size, const std::string &label, const std::string &local_key, const std::string &peer_key);
+    static bool derive(unsigned char *dest, size_t size, const unsigned char *key, int key_size, const unsigned char *salt, int salt_size, const unsigned char *info, int info_size);
+
+    const EVP_CIPHER *get_cipher() const;
+    void get_nonce(unsigned char *dest, unsigned long counter, bool initiator) const;
+    void get_chunk_nonce(unsigned char *dest, int transfer, unsigned long index, bool initiator) const;
 
 };
 
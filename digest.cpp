@@ -0,0 +1,44 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "digest.h"
+
+Digest::Digest() {
+    _size = 0;
+    SHA256_Init(&_context);
+}
+
+void Digest::add(const unsigned char *leaf, long size) {
+    SHA256_Update(&_context, leaf, __digest_size);
+    memcpy(_last, leaf, sizeof _last);
+    _size += size;
+}
+
+void Digest::add(const std::string &leaf, long size) {
+    add((const unsigned char *) leaf.data(), size);
+}
+
+std::string Digest::finish() {
+
+    unsigned char root[__digest_size];
+
+    SHA256_Update(&_context, &_size, sizeof _size);
+    SHA256_Final(root, &_context);
+    return std::string((char *) root, sizeof root);
+}
+
+void Digest::leaf(unsigned char *dest, const block_t &source) {
+    SHA256(source._data, source._size, dest);
+}
@@ -0,0 +1,57 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef digest_h
+#define	digest_h
+
+#include <string>
+#include <openssl/sha.h>
+#include "block.h"
+
+#define __digest_size   SHA256_DIGEST_LENGTH
+
+/*
+  Whole file digest built as a two level SHA-256 tree. Every chunk of a
+  transfer is hashed on its own, which the engine workers do alongside the
+  cipher so leaves are computed on all cores, and the leaves are folded in
+  chunk order into a root that also covers the byte count, so truncated or
+  reordered data changes the root. The leaves are the same hashes the resume
+  manifest keeps, which lets a resumed transfer seed the tree with the
+  chunks it already has.
+ */
+class Digest {
+public:
+
+    Digest();
+
+    void add(const unsigned char *leaf, long size);
+    void add(const std::string &leaf, long size);
+    std::string finish();
+
+    std::string last() const {
+        return std::string((const char *) _last, sizeof _last);
+    }
+
+    static void leaf(unsigned char *dest, const block_t &source);
+
+private:
+
+    long _size;
+    unsigned char _last[__digest_size];
+    SHA256_CTX _context;
+
+};
+
+#endif
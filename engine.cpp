@@ -0,0 +1,168 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "engine.h"
+
+Engine::Engine(const Crypto &crypto, bool encrypt, bool compress, int transfer, int threads, int depth, Digest *digest) : _crypto(crypto), _slots(depth), _workers(threads) {
+    _encrypt = encrypt;
+    _digest = digest;
+    _compress = compress;
+    _closed = _failed = false;
+    _transfer = transfer;
+    _next_in = _next_out = 0;
+    for (size_t i = 0; i < _slots.size(); i++)
+        _slots[i]._state = empty;
+    pthread_cond_init(&_cond, NULL);
+    pthread_mutex_init(&_mutex, NULL);
+    for (size_t i = 0; i < _workers.size(); i++)
+        pthread_create(&_workers[i], NULL, &Engine::worker, this);
+}
+
+Engine::~Engine() {
+    pthread_mutex_lock(&_mutex);
+    _closed = _failed = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    for (size_t i = 0; i < _workers.size(); i++)
+        pthread_join(_workers[i], NULL);
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+}
+
+bool Engine::push(block_t &block) {
+
+    slot_t *slot;
+
+    pthread_mutex_lock(&_mutex);
+    slot = &_slots[_next_in % _slots.size()];
+    while (slot->_state != empty && !_closed && !_failed)
+        pthread_cond_wait(&_cond, &_mutex);
+    if (_closed || _failed) {
+        pthread_mutex_unlock(&_mutex);
+        return false;
+    }
+    slot->_block.swap(block);
+    slot->_index = _next_in++;
+    slot->_state = pending;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    return true;
+}
+
+bool Engine::pop(block_t &block) {
+
+    slot_t *slot;
+
+    pthread_mutex_lock(&_mutex);
+    slot = &_slots[_next_out % _slots.size()];
+    while (slot->_state != done && !_failed && !(_closed && _next_out == _next_in))
+        pthread_cond_wait(&_cond, &_mutex);
+    if (slot->_state != done || _failed) {
+        pthread_mutex_unlock(&_mutex);
+        return false;
+    }
+    slot->_block.swap(block);
+    slot->_state = empty;
+    if (_digest)
+        _digest->add(slot->_leaf, slot->_leaf_size);
+    _next_out++;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+    return true;
+}
+
+void Engine::close() {
+    pthread_mutex_lock(&_mutex);
+    _closed = true;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Engine::seal(block_t &dest, const block_t &source) {
+
+    unsigned long index;
+
+    pthread_mutex_lock(&_mutex);
+    index = _next_in++;
+    pthread_mutex_unlock(&_mutex);
+    _crypto.encrypt_chunk(dest, source, _transfer, index);
+}
+
+void Engine::open(block_t &dest, const block_t &source) {
+
+    unsigned long index;
+
+    pthread_mutex_lock(&_mutex);
+    index = _next_in++;
+    pthread_mutex_unlock(&_mutex);
+    _crypto.decrypt_chunk(dest, source, _transfer, index);
+}
+
+void *Engine::worker() {
+
+    slot_t *slot;
+    block_t block, packed;
+    Compressor compressor;
+
+    pthread_mutex_lock(&_mutex);
+    while (!_failed) {
+        slot = NULL;
+        for (unsigned long i = _next_out; i < _next_in && !slot; i++)
+            if (_slots[i % _slots.size()]._state == pending)
+                slot = &_slots[i % _slots.size()];
+        if (!slot) {
+            if (_closed)
+                break;
+            pthread_cond_wait(&_cond, &_mutex);
+            continue;
+        }
+        slot->_state = working;
+        pthread_mutex_unlock(&_mutex);
+        try {
+            if (_digest && _encrypt) {
+                Digest::leaf(slot->_leaf, slot->_block);
+                slot->_leaf_size = slot->_block._size;
+            }
+            if (slot->_block._size) {
+                if (_encrypt) {
+                    if (_compress) {
+                        compressor.compress(packed, slot->_block);
+                        slot->_block.swap(packed);
+                    }
+                    _crypto.encrypt_chunk(block, slot->_block, _transfer, slot->_index);
+                } else {
+                    _crypto.decrypt_chunk(block, slot->_block, _transfer, slot->_index);
+                    if (_compress) {
+                        compressor.decompress(packed, block);
+                        block.swap(packed);
+                    }
+                }
+                slot->_block.swap(block);
+            }
+            if (_digest && !_encrypt) {
+                Digest::leaf(slot->_leaf, slot->_block);
+                slot->_leaf_size = slot->_block._size;
+            }
+            pthread_mutex_lock(&_mutex);
+            slot->_state = done;
+        } catch (const std::exception &exception) {
+            pthread_mutex_lock(&_mutex);
+            _failed = true;
+        }
+        pthread_cond_broadcast(&_cond);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return NULL;
+}
@@ -0,0 +1,81 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef engine_h
+#define	engine_h
+
+#include <vector>
+#include <pthread.h>
+#include "crypto.h"
+#include "compressor.h"
+#include "digest.h"
+
+/*
+  Worker pool that encrypts or decrypts the chunks of one file transfer in
+  parallel. Chunks are numbered in the order they are pushed, sealed with a
+  nonce derived from that number, and popped back out in the same order
+  regardless of which worker finished first. Workers also run the chunk
+  compression stage when the session negotiated it, and hash the plain
+  chunks into the leaves of the transfer digest when one is attached.
+ */
+class Engine {
+public:
+
+    Engine(const Crypto &crypto, bool encrypt, bool compress, int transfer, int threads, int depth, Digest *digest = NULL);
+    ~Engine();
+
+    bool push(block_t &block);
+    bool pop(block_t &block);
+    void close();
+    void seal(block_t &dest, const block_t &source);
+    void open(block_t &dest, const block_t &source);
+
+    bool is_failed() const {
+        return _failed;
+    }
+
+    static void *worker(void *engine) {
+        return ((Engine *) engine)->worker();
+    }
+
+private:
+
+    enum state_t {
+        empty, pending, working, done
+    };
+
+    struct slot_t {
+        state_t _state;
+        int _leaf_size;
+        unsigned long _index;
+        unsigned char _leaf[__digest_size];
+        block_t _block;
+    };
+
+    const Crypto &_crypto;
+    bool _encrypt, _compress, _closed, _failed;
+    int _transfer;
+    unsigned long _next_in, _next_out;
+    std::vector<slot_t> _slots;
+    std::vector<pthread_t> _workers;
+    Digest *_digest;
+    pthread_cond_t _cond;
+    pthread_mutex_t _mutex;
+
+    void *worker();
+
+};
+
+#endif
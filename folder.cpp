@@ -0,0 +1,339 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "folder.h"
+
+Folder::Folder(int workers, int depth, int block_size) : _failed(false) {
+    _count = std::max(workers, 1);
+    _depth = std::max(depth, 1);
+    _block_size = block_size;
+    _busy = 0;
+    _size = _blocks = _next = 0;
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_cond, NULL);
+}
+
+Folder::~Folder() {
+    close();
+    pthread_mutex_destroy(&_mutex);
+    pthread_cond_destroy(&_cond);
+}
+
+void Folder::scan(const std::string &root) {
+
+    std::vector<pthread_t> walkers(_count);
+
+    _root = root;
+    _entries.clear();
+    _pending.assign(1, "");
+    _busy = 0;
+    for (int i = 0; i < _count; i++)
+        pthread_create(&walkers[i], NULL, &Folder::walker, this);
+    for (int i = 0; i < _count; i++)
+        pthread_join(walkers[i], NULL);
+    if (_failed)
+        throw std::runtime_error("can't read directory");
+    std::sort(_entries.begin(), _entries.end(), &Folder::is_before);
+    index();
+}
+
+void Folder::encode(std::string &data) const {
+
+    int length;
+
+    data.clear();
+    for (size_t i = 0; i < _entries.size(); i++) {
+        length = _entries[i]._path.size();
+        data.append((char *) &_entries[i]._mode, sizeof _entries[i]._mode);
+        data.append((char *) &_entries[i]._size, sizeof _entries[i]._size);
+        data.append((char *) &length, sizeof length);
+        data.append(_entries[i]._path);
+    }
+}
+
+void Folder::decode(const std::string &data) {
+
+    int length;
+    size_t pos = 0;
+    entry_t entry;
+
+    _entries.clear();
+    while (pos < data.size()) {
+        if (data.size() - pos < sizeof entry._mode + sizeof entry._size + sizeof length)
+            throw std::runtime_error("malformed block received");
+        memcpy(&entry._mode, data.data() + pos, sizeof entry._mode);
+        pos += sizeof entry._mode;
+        memcpy(&entry._size, data.data() + pos, sizeof entry._size);
+        pos += sizeof entry._size;
+        memcpy(&length, data.data() + pos, sizeof length);
+        pos += sizeof length;
+        if (length <= 0 || (size_t) length > data.size() - pos || entry._size < 0)
+            throw std::runtime_error("malformed block received");
+        entry._path = data.substr(pos, length);
+        pos += length;
+        if (!is_safe(entry._path) || (!S_ISDIR(entry._mode) && !S_ISREG(entry._mode)))
+            throw std::runtime_error("malformed block received");
+        _entries.push_back(entry);
+    }
+    index();
+}
+
+void Folder::create(const std::string &root) {
+
+    int fd;
+    std::string path;
+    struct stat info;
+
+    _root = root;
+    if (mkdir(root.c_str(), 0755) && (errno != EEXIST || stat(root.c_str(), &info) || !S_ISDIR(info.st_mode)))
+        throw std::runtime_error("can't write file");
+    for (size_t i = 0; i < _entries.size(); i++) {
+        path = root + "/" + _entries[i]._path;
+        if (S_ISDIR(_entries[i]._mode)) {
+            if (mkdir(path.c_str(), (_entries[i]._mode & 0777) | 0700) && errno != EEXIST)
+                throw std::runtime_error("can't write file");
+        } else if (!_entries[i]._size) {
+            if ((fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, _entries[i]._mode & 0777)) < 0)
+                throw std::runtime_error("can't write file");
+            ::close(fd);
+        }
+    }
+}
+
+void Folder::start(bool sending) {
+
+    worker_t *worker;
+
+    _next = 0;
+    for (int i = 0; i < _count; i++) {
+        worker = new worker_t;
+        worker->_folder = this;
+        worker->_index = i;
+        worker->_fd = -1;
+        worker->_file = -1;
+        worker->_sending = sending;
+        worker->_ring = new Ring(_depth);
+        _workers.push_back(worker);
+    }
+    for (int i = 0; i < _count; i++)
+        pthread_create(&_workers[i]->_thread, NULL, &Folder::worker, _workers[i]);
+}
+
+bool Folder::read(block_t &dest) {
+    if (!_workers[_next++ % _count]->_ring->pop(dest))
+        return false;
+    return !_failed;
+}
+
+bool Folder::write(block_t &source) {
+    if (!_workers[_next++ % _count]->_ring->push(source))
+        return false;
+    return !_failed;
+}
+
+bool Folder::close() {
+    for (size_t i = 0; i < _workers.size(); i++)
+        _workers[i]->_ring->close();
+    for (size_t i = 0; i < _workers.size(); i++) {
+        pthread_join(_workers[i]->_thread, NULL);
+        if (_workers[i]->_fd >= 0 && ::close(_workers[i]->_fd))
+            _failed = true;
+        delete _workers[i]->_ring;
+        delete _workers[i];
+    }
+    _workers.clear();
+    return !_failed;
+}
+
+void *Folder::walk() {
+
+    std::string dir;
+    std::vector<entry_t> found;
+
+    pthread_mutex_lock(&_mutex);
+    while (true) {
+        while (_pending.empty() && _busy)
+            pthread_cond_wait(&_cond, &_mutex);
+        if (_pending.empty())
+            break;
+        dir = _pending.front();
+        _pending.pop_front();
+        _busy++;
+        pthread_mutex_unlock(&_mutex);
+        found.clear();
+        if (!list(dir, found))
+            _failed = true;
+        pthread_mutex_lock(&_mutex);
+        for (size_t i = 0; i < found.size(); i++) {
+            if (S_ISDIR(found[i]._mode))
+                _pending.push_back(found[i]._path);
+            _entries.push_back(found[i]);
+        }
+        _busy--;
+        pthread_cond_broadcast(&_cond);
+    }
+    pthread_mutex_unlock(&_mutex);
+    return NULL;
+}
+
+bool Folder::list(const std::string &dir, std::vector<entry_t> &found) {
+
+    DIR *stream = opendir((dir.empty() ? _root : _root + "/" + dir).c_str());
+    dirent *item;
+    struct stat info;
+    entry_t entry;
+
+    if (!stream)
+        return false;
+    while ((item = readdir(stream))) {
+        if (!strcmp(item->d_name, ".") || !strcmp(item->d_name, ".."))
+            continue;
+        if (fstatat(dirfd(stream), item->d_name, &info, AT_SYMLINK_NOFOLLOW))
+            continue;
+        if (!S_ISDIR(info.st_mode) && !S_ISREG(info.st_mode))
+            continue;
+        entry._path = dir.empty() ? item->d_name : dir + "/" + item->d_name;
+        entry._size = S_ISREG(info.st_mode) ? info.st_size : 0;
+        entry._mode = info.st_mode;
+        found.push_back(entry);
+    }
+    closedir(stream);
+    return true;
+}
+
+void Folder::index() {
+    _files.clear();
+    _starts.clear();
+    _size = 0;
+    for (size_t i = 0; i < _entries.size(); i++)
+        if (S_ISREG(_entries[i]._mode)) {
+            _files.push_back(i);
+            _starts.push_back(_size);
+            _size += _entries[i]._size;
+        }
+    _blocks = std::max((_size + _block_size - 1) / _block_size, 1L);
+}
+
+void *Folder::copy(worker_t &worker) {
+
+    block_t block;
+
+    if (worker._sending)
+        for (long i = worker._index; i < _blocks; i += _count) {
+            block._cmd = block_t::data;
+            block._size = std::min((long) _block_size, _size - i * _block_size);
+            block.reserve(block._size);
+            if (!copy(worker, block, i * _block_size))
+                _failed = true;
+            if (!worker._ring->push(block))
+                break;
+        }
+    else
+        for (long i = worker._index; worker._ring->pop(block); i += _count)
+            if (!copy(worker, block, i * _block_size))
+                _failed = true;
+    return NULL;
+}
+
+bool Folder::copy(worker_t &worker, block_t &block, long offset) {
+
+    long done = 0, position, piece, file = std::upper_bound(_starts.begin(), _starts.end(), offset) - _starts.begin() - 1;
+    const entry_t *entry;
+
+    while (done < block._size) {
+        if (file < 0 || file >= (long) _files.size())
+            return false;
+        entry = &_entries[_files[file]];
+        position = offset + done - _starts[file];
+        piece = std::min(block._size - done, entry->_size - position);
+        if (piece > 0) {
+            if (!open_file(worker, file))
+                return false;
+            if (!worker._sending && !position && ftruncate(worker._fd, entry->_size))
+                return false;
+            if (worker._sending ? !pread_all(worker._fd, block._data + done, piece, position) : !pwrite_all(worker._fd, block._data + done, piece, position))
+                return false;
+            done += piece;
+        }
+        file++;
+    }
+    return true;
+}
+
+bool Folder::open_file(worker_t &worker, long file) {
+
+    const entry_t &entry = _entries[_files[file]];
+    std::string path = _root + "/" + entry._path;
+
+    if (worker._file == file)
+        return true;
+    if (worker._fd >= 0)
+        ::close(worker._fd);
+    worker._file = file;
+    if (worker._sending)
+        worker._fd = ::open(path.c_str(), O_RDONLY);
+    else
+        worker._fd = ::open(path.c_str(), O_WRONLY | O_CREAT, entry._mode & 0777);
+    return worker._fd >= 0;
+}
+
+bool Folder::is_before(const entry_t &a, const entry_t &b) {
+    return a._path < b._path;
+}
+
+bool Folder::is_safe(const std::string &path) {
+
+    size_t start = 0, end;
+    std::string part;
+
+    if (path.empty() || path[0] == '/' || path.find('\0') != path.npos)
+        return false;
+    do {
+        end = path.find('/', start);
+        part = path.substr(start, end == path.npos ? path.npos : end - start);
+        if (part.empty() || part == "." || part == "..")
+            return false;
+        start = end + 1;
+    } while (end != path.npos);
+    return true;
+}
+
+bool Folder::pread_all(int fd, unsigned char *data, long size, long offset) {
+
+    long count;
+
+    while (size > 0) {
+        if ((count = pread(fd, data, size, offset)) <= 0)
+            return false;
+        data += count;
+        size -= count;
+        offset += count;
+    }
+    return true;
+}
+
+bool Folder::pwrite_all(int fd, const unsigned char *data, long size, long offset) {
+
+    long count;
+
+    while (size > 0) {
+        if ((count = pwrite(fd, data, size, offset)) < 0)
+            return false;
+        data += count;
+        size -= count;
+        offset += count;
+    }
+    return true;
+}
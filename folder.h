@@ -0,0 +1,118 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef folder_h
+#define	folder_h
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include "block.h"
+#include "ring.h"
+
+/*
+  Directory tree sent as a single transfer. A pool of walkers lists the tree
+  into entries of relative path, mode and size, and the contents of the
+  regular files are concatenated in entry order and cut into fixed size
+  blocks, so small files share blocks and the whole tree costs one offer.
+  Block i is read or written by worker i % N through a ring of its own,
+  which keeps the stream in order while files are opened and copied
+  concurrently.
+ */
+class Folder {
+public:
+
+    struct entry_t {
+        std::string _path;
+        long _size;
+        int _mode;
+    };
+
+    Folder(int workers, int depth, int block_size);
+    ~Folder();
+
+    void scan(const std::string &root);
+    void encode(std::string &data) const;
+    void decode(const std::string &data);
+    void create(const std::string &root);
+    void start(bool sending);
+    bool read(block_t &dest);
+    bool write(block_t &source);
+    bool close();
+
+    static bool is_safe(const std::string &path);
+
+    long size() const {
+        return _size;
+    }
+
+    long files() const {
+        return _files.size();
+    }
+
+private:
+
+    struct worker_t {
+        Folder *_folder;
+        int _index, _fd;
+        long _file;
+        bool _sending;
+        Ring *_ring;
+        pthread_t _thread;
+    };
+
+    int _count, _depth, _block_size, _busy;
+    long _size, _blocks, _next;
+    std::string _root;
+    std::vector<entry_t> _entries;
+    std::vector<long> _files, _starts;
+    std::deque<std::string> _pending;
+    std::vector<worker_t *> _workers;
+    std::atomic<bool> _failed;
+    pthread_mutex_t _mutex;
+    pthread_cond_t _cond;
+
+    static void *walker(void *folder) {
+        return ((Folder *) folder)->walk();
+    }
+
+    static void *worker(void *worker) {
+        return ((worker_t *) worker)->_folder->copy(*(worker_t *) worker);
+    }
+
+    void *walk();
+    bool list(const std::string &dir, std::vector<entry_t> &found);
+    void index();
+    void *copy(worker_t &worker);
+    bool copy(worker_t &worker, block_t &block, long offset);
+    bool open_file(worker_t &worker, long file);
+
+    static bool is_before(const entry_t &a, const entry_t &b);
+    static bool pread_all(int fd, unsigned char *data, long size, long offset);
+    static bool pwrite_all(int fd, const unsigned char *data, long size, long offset);
+
+};
+
+#endif
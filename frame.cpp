@@ -0,0 +1,74 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "frame.h"
+
+int Frame::encode(unsigned char *dest, const header_t &header) {
+
+    int size = 2;
+
+    dest[0] = __frame_compact | header.cmd;
+    dest[1] = header.flags;
+    size += put_varint(dest + size, header.stream);
+    size += put_varint(dest + size, header.size);
+    return size;
+}
+
+int Frame::decode(header_t &header, const unsigned char *source, int size) {
+
+    int used = 2, bytes;
+    unsigned int value;
+
+    if (size < used)
+        return 0;
+    if (!is_compact(source[0]) || (source[0] & ~__frame_mask) > block_t::abort)
+        throw std::runtime_error("malformed block received");
+    header.cmd = (block_t::cmd_t) (source[0] & ~__frame_mask);
+    header.flags = source[1];
+    if (!(bytes = get_varint(header.stream, source + used, size - used)))
+        return 0;
+    used += bytes;
+    if (!(bytes = get_varint(value, source + used, size - used)))
+        return 0;
+    if (value > __frame_size_max)
+        throw std::runtime_error("oversized block received");
+    header.size = value;
+    return used + bytes;
+}
+
+int Frame::put_varint(unsigned char *dest, unsigned int value) {
+
+    int size = 0;
+
+    while (value >= 0x80) {
+        dest[size++] = value | 0x80;
+        value >>= 7;
+    }
+    dest[size++] = value;
+    return size;
+}
+
+int Frame::get_varint(unsigned int &value, const unsigned char *source, int size) {
+
+    value = 0;
+    for (int i = 0; i < 5; i++) {
+        if (i == size)
+            return 0;
+        value |= (unsigned int) (source[i] & 0x7f) << 7 * i;
+        if (!(source[i] & 0x80))
+            return i + 1;
+    }
+    throw std::runtime_error("malformed block received");
+}
@@ -0,0 +1,64 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef frame_h
+#define	frame_h
+
+#include <stdexcept>
+#include "block.h"
+
+#define __frame_header_max  12
+#define __frame_size_max    (__block_size + 8)
+#define __frame_compact     0x80
+#define __frame_mask        0xc0
+#define __frame_raw         0x1
+#define __frame_indexed     0x2
+
+/*
+  Version 5 wire header: one byte holding the command tagged with the
+  compact marker, one byte of flags, then the stream id and payload length
+  as little endian base 128 varints. Legacy headers start with the low byte
+  of the command enum, which never has the marker bit set, so a reader can
+  tell the two formats apart frame by frame. The raw flag marks payloads
+  sealed by a stream's transfer engine rather than the session cipher, and
+  the indexed flag marks a chunk followed by its 8 byte index in the stream
+  so a striped receiver can put chunks from several connections in order.
+  Payloads are capped at one block plus that index. Neither call
+  allocates.
+ */
+class Frame {
+public:
+
+    struct header_t {
+        block_t::cmd_t cmd;
+        int flags, size;
+        unsigned int stream;
+    };
+
+    static int encode(unsigned char *dest, const header_t &header);
+    static int decode(header_t &header, const unsigned char *source, int size);
+
+    static bool is_compact(unsigned char byte) {
+        return (byte & __frame_mask) == __frame_compact;
+    }
+
+private:
+
+    static int put_varint(unsigned char *dest, unsigned int value);
+    static int get_varint(unsigned int &value, const unsigned char *source, int size);
+
+};
+
+#endif
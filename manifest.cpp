@@ -0,0 +1,121 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "manifest.h"
+
+Manifest::Manifest() {
+}
+
+Manifest::~Manifest() {
+    _file.close();
+}
+
+bool Manifest::load(const std::string &path, const std::string &content_id) {
+
+    std::string line;
+    std::ifstream file((path + __manifest_suffix).c_str());
+    struct stat info;
+    long chunks;
+
+    _hashes.clear();
+    if (!file || !std::getline(file, line) || line != "content_id " + to_hex(content_id))
+        return false;
+    while (std::getline(file, line) && line.size() == 2 * SHA256_DIGEST_LENGTH)
+        _hashes.push_back(from_hex(line));
+    chunks = stat(path.c_str(), &info) ? 0 : info.st_size / (__data_size);
+    if ((long) _hashes.size() > chunks)
+        _hashes.resize(chunks);
+    return true;
+}
+
+void Manifest::create(const std::string &path, const std::string &content_id, long chunks) {
+    _path = path + __manifest_suffix;
+    _hashes.resize(chunks);
+    _file.close();
+    _file.open(_path.c_str(), std::ofstream::trunc);
+    _file << "content_id " << to_hex(content_id) << "\n";
+    for (long i = 0; i < chunks; i++)
+        _file << to_hex(_hashes[i]) << "\n";
+    _file.flush();
+    if (!_file)
+        throw std::runtime_error("can't write manifest");
+}
+
+void Manifest::append(const unsigned char *data, int size) {
+    append(hash(data, size));
+}
+
+void Manifest::append(const std::string &hash) {
+    _hashes.push_back(hash);
+    _file << to_hex(_hashes.back()) << "\n";
+    _file.flush();
+}
+
+void Manifest::remove() {
+    _file.close();
+    unlink(_path.c_str());
+    _hashes.clear();
+}
+
+std::string Manifest::hash(const unsigned char *data, int size) {
+
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+
+    SHA256(data, size, digest);
+    return std::string((char *) digest, sizeof digest);
+}
+
+std::string Manifest::content_id(const std::string &path, std::ifstream &file, long size) {
+
+    std::vector<char> chunk(__data_size);
+    struct stat info;
+    long modified = stat(path.c_str(), &info) ? 0 : info.st_mtime, offsets[2] = {0, size > __data_size ? size - __data_size : 0};
+    unsigned char digest[SHA256_DIGEST_LENGTH];
+    SHA256_CTX ctx;
+
+    SHA256_Init(&ctx);
+    SHA256_Update(&ctx, &size, sizeof size);
+    SHA256_Update(&ctx, &modified, sizeof modified);
+    for (int i = 0; i < 2; i++) {
+        file.seekg(offsets[i], std::ifstream::beg);
+        file.read(&chunk[0], chunk.size());
+        SHA256_Update(&ctx, &chunk[0], file.gcount());
+        file.clear();
+    }
+    file.seekg(0, std::ifstream::beg);
+    SHA256_Final(digest, &ctx);
+    return std::string((char *) digest, sizeof digest);
+}
+
+std::string Manifest::to_hex(const std::string &data) {
+
+    const char digits[] = "0123456789abcdef";
+    std::string hex;
+
+    for (size_t i = 0; i < data.size(); i++) {
+        hex += digits[(unsigned char) data[i] >> 4];
+        hex += digits[(unsigned char) data[i] & 0xf];
+    }
+    return hex;
+}
+
+std::string Manifest::from_hex(const std::string &hex) {
+
+    std::string data;
+
+    for (size_t i = 0; i + 1 < hex.size(); i += 2)
+        data += (char) strtol(hex.substr(i, 2).c_str(), NULL, 16);
+    return data;
+}
@@ -0,0 +1,66 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef manifest_h
+#define	manifest_h
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <stdexcept>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <openssl/sha.h>
+#include "crypto.h"
+
+#define __manifest_suffix   ".safechat-manifest"
+
+/*
+  Sidecar file next to a partially received file listing the content id of
+  the offer and the SHA-256 of every chunk written so far, one hex line per
+  chunk. A later offer of the same content resumes after the longest prefix
+  of chunks whose hashes the sender agrees with.
+ */
+class Manifest {
+public:
+
+    Manifest();
+    ~Manifest();
+
+    bool load(const std::string &path, const std::string &content_id);
+    void create(const std::string &path, const std::string &content_id, long chunks);
+    void append(const unsigned char *data, int size);
+    void append(const std::string &hash);
+    void remove();
+
+    const std::vector<std::string> &hashes() const {
+        return _hashes;
+    }
+
+    static std::string hash(const unsigned char *data, int size);
+    static std::string content_id(const std::string &path, std::ifstream &file, long size);
+    static std::string to_hex(const std::string &data);
+    static std::string from_hex(const std::string &hex);
+
+private:
+
+    std::string _path;
+    std::vector<std::string> _hashes;
+    std::ofstream _file;
+
+};
+
+#endif
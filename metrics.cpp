@@ -0,0 +1,203 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "metrics.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <algorithm>
+
+static const char *counter_names[__metric_counters] = {
+    "bytes_sent", "bytes_received", "blocks_sent", "blocks_received"
+};
+
+static const char *histogram_names[__metric_histograms] = {
+    "encrypt_ns", "decrypt_ns", "wait_ns", "send_ns", "disk_write_ns"
+};
+
+static const char *percentile_names[] = {"p50", "p90", "p99", "p999"};
+static const double percentiles[] = {0.5, 0.9, 0.99, 0.999};
+
+bool Metrics::_enabled = false;
+int Metrics::_socket = -1;
+Metrics::slots_t *Metrics::_threads = NULL, Metrics::_retired;
+unsigned long Metrics::_last_counters[__metric_counters];
+timespec Metrics::_start_time, Metrics::_last_time;
+pthread_mutex_t Metrics::_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+Metrics::local_t::local_t() {
+    _slots = new slots_t();
+    pthread_mutex_lock(&_mutex);
+    _slots->_next = _threads;
+    _threads = _slots;
+    pthread_mutex_unlock(&_mutex);
+}
+
+Metrics::local_t::~local_t() {
+
+    slots_t **slots;
+
+    pthread_mutex_lock(&_mutex);
+    merge(_retired, *_slots);
+    for (slots = &_threads; *slots != _slots; slots = &(*slots)->_next);
+    *slots = _slots->_next;
+    pthread_mutex_unlock(&_mutex);
+    delete _slots;
+}
+
+void Metrics::enable(bool enabled) {
+    pthread_mutex_lock(&_mutex);
+    if (enabled && !_enabled) {
+        clock_gettime(CLOCK_MONOTONIC, &_start_time);
+        _last_time = _start_time;
+    }
+    _enabled = enabled;
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool Metrics::serve(const std::string &path) {
+
+    sockaddr_un addr;
+    pthread_t thread;
+
+    if (path.size() >= sizeof addr.sun_path || (_socket = socket(AF_UNIX, SOCK_STREAM, 0)) < 0)
+        return false;
+    memset(&addr, 0, sizeof addr);
+    addr.sun_family = AF_UNIX;
+    memcpy(addr.sun_path, path.c_str(), path.size());
+    unlink(path.c_str());
+    if (bind(_socket, (sockaddr *) & addr, sizeof addr) || listen(_socket, 4) || pthread_create(&thread, NULL, &Metrics::server, NULL)) {
+        close(_socket);
+        _socket = -1;
+        return false;
+    }
+    pthread_detach(thread);
+    return true;
+}
+
+std::string Metrics::snapshot() {
+
+    int bucket;
+    unsigned long count, target, seen;
+    double elapsed, interval;
+    timespec now;
+    slots_t *total = new slots_t();
+    std::ostringstream json;
+
+    pthread_mutex_lock(&_mutex);
+    merge(*total, _retired);
+    for (slots_t *slots = _threads; slots; slots = slots->_next)
+        merge(*total, *slots);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = now.tv_sec - _start_time.tv_sec + (now.tv_nsec - _start_time.tv_nsec) / 1e9;
+    interval = now.tv_sec - _last_time.tv_sec + (now.tv_nsec - _last_time.tv_nsec) / 1e9;
+    json << "{\"enabled\": " << (_enabled ? "true" : "false") << ", \"uptime\": " << elapsed << ", \"counters\": {";
+    for (int i = 0; i < __metric_counters; i++)
+        json << (i ? ", \"" : "\"") << counter_names[i] << "\": " << total->_counters[i];
+    json << "}, \"per_second\": {";
+    for (int i = 0; i < __metric_counters; i++) {
+        json << (i ? ", \"" : "\"") << counter_names[i] << "\": " << (interval > 0 ? (total->_counters[i] - _last_counters[i]) / interval : 0);
+        _last_counters[i] = total->_counters[i];
+    }
+    _last_time = now;
+    pthread_mutex_unlock(&_mutex);
+    json << "}, \"histograms\": {";
+    for (int i = 0; i < __metric_histograms; i++) {
+        histogram_t &histogram = total->_histograms[i];
+        count = histogram._count;
+        json << (i ? ", \"" : "\"") << histogram_names[i] << "\": {\"count\": " << count << ", \"mean\": " << (count ? histogram._sum / count : 0);
+        for (int j = 0; j < 4; j++) {
+            target = std::max((unsigned long) (count * percentiles[j] + 0.5), 1UL);
+            seen = 0;
+            for (bucket = 0; bucket < __metric_buckets - 1 && (seen += histogram._buckets[bucket]) < target; bucket++);
+            json << ", \"" << percentile_names[j] << "\": " << (count ? bucket_value(bucket) : 0);
+        }
+        json << ", \"max\": " << histogram._max << "}";
+    }
+    json << "}}\n";
+    delete total;
+    return json.str();
+}
+
+Metrics::slots_t &Metrics::local() {
+
+    static thread_local local_t local;
+
+    return *local._slots;
+}
+
+void Metrics::record(int histogram, unsigned long value) {
+
+    histogram_t &dest = local()._histograms[histogram];
+
+    bump(dest._count, 1);
+    bump(dest._sum, value);
+    bump(dest._buckets[bucket(value)], 1);
+    if (value > dest._max.load(std::memory_order_relaxed))
+        dest._max.store(value, std::memory_order_relaxed);
+}
+
+int Metrics::bucket(unsigned long value) {
+
+    int exponent;
+
+    if (value < __metric_sub)
+        return value;
+    exponent = 63 - __builtin_clzl(value);
+    return (exponent - __metric_sub_bits + 1) * __metric_sub + (value >> (exponent - __metric_sub_bits) & (__metric_sub - 1));
+}
+
+unsigned long Metrics::bucket_value(int bucket) {
+    if (bucket < __metric_sub)
+        return bucket;
+    return (unsigned long) (__metric_sub + bucket % __metric_sub) << (bucket / __metric_sub - 1);
+}
+
+void Metrics::merge(slots_t &dest, const slots_t &source) {
+    for (int i = 0; i < __metric_counters; i++)
+        bump(dest._counters[i], source._counters[i].load(std::memory_order_relaxed));
+    for (int i = 0; i < __metric_histograms; i++) {
+        const histogram_t &from = source._histograms[i];
+        histogram_t &to = dest._histograms[i];
+        bump(to._count, from._count.load(std::memory_order_relaxed));
+        bump(to._sum, from._sum.load(std::memory_order_relaxed));
+        if (from._max.load(std::memory_order_relaxed) > to._max.load(std::memory_order_relaxed))
+            to._max.store(from._max.load(std::memory_order_relaxed), std::memory_order_relaxed);
+        for (int j = 0; j < __metric_buckets; j++)
+            bump(to._buckets[j], from._buckets[j].load(std::memory_order_relaxed));
+    }
+}
+
+void *Metrics::accept_clients() {
+
+    int client;
+    ssize_t bytes;
+    std::string json;
+
+    while (true) {
+        client = accept(_socket, NULL, NULL);
+        if (client < 0 && errno == EINTR)
+            continue;
+        if (client < 0)
+            return NULL;
+        json = snapshot();
+        for (size_t sent = 0; sent < json.size(); sent += bytes)
+            if ((bytes = send(client, json.data() + sent, json.size() - sent, MSG_NOSIGNAL)) <= 0)
+                break;
+        close(client);
+    }
+}
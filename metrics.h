@@ -0,0 +1,129 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef metrics_h
+#define	metrics_h
+
+#include <string>
+#include <atomic>
+#include <sstream>
+#include <pthread.h>
+#include <time.h>
+
+#define __metric_bytes_sent     0
+#define __metric_bytes_received 1
+#define __metric_blocks_sent    2
+#define __metric_blocks_received    3
+#define __metric_counters       4
+
+#define __metric_encrypt_ns     0
+#define __metric_decrypt_ns     1
+#define __metric_wait_ns        2
+#define __metric_send_ns        3
+#define __metric_disk_write_ns  4
+#define __metric_histograms     5
+
+#define __metric_sub_bits       4
+#define __metric_sub            (1 << __metric_sub_bits)
+#define __metric_buckets        (64 - __metric_sub_bits + 1) * __metric_sub
+
+/*
+  Process wide counters and latency histograms for the hot paths. Every
+  thread records into its own slots, which only it writes, so recording is
+  a relaxed load and store with no locking or shared cache lines; the slots
+  of a thread that exits are folded into a retired total. Histograms are
+  log linear with 16 sub-buckets per power of two, which keeps them within
+  about 6% of the true value over the whole range of a 64 bit nanosecond
+  count. Snapshots sum every thread under a lock and render as JSON, and
+  are served to anyone connecting to a local Unix socket. While disabled
+  every call is a single predictable branch and no clock is read.
+ */
+class Metrics {
+public:
+
+    static void enable(bool enabled);
+    static bool serve(const std::string &path);
+    static std::string snapshot();
+
+    static bool is_enabled() {
+        return _enabled;
+    }
+
+    static void add(int counter, long value) {
+        if (_enabled)
+            bump(local()._counters[counter], value);
+    }
+
+    static void begin(timespec &start) {
+        if (_enabled)
+            clock_gettime(CLOCK_MONOTONIC, &start);
+    }
+
+    static void end(int histogram, const timespec &start) {
+
+        timespec now;
+        long elapsed;
+
+        if (!_enabled)
+            return;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        elapsed = (now.tv_sec - start.tv_sec) * 1000000000L + now.tv_nsec - start.tv_nsec;
+        record(histogram, elapsed > 0 ? elapsed : 0);
+    }
+
+    static void *server(void *) {
+        return accept_clients();
+    }
+
+private:
+
+    struct histogram_t {
+        std::atomic<unsigned long> _count, _sum, _max, _buckets[__metric_buckets];
+    };
+
+    struct slots_t {
+        std::atomic<unsigned long> _counters[__metric_counters];
+        histogram_t _histograms[__metric_histograms];
+        slots_t *_next;
+    };
+
+    struct local_t {
+        slots_t *_slots;
+
+        local_t();
+        ~local_t();
+    };
+
+    static bool _enabled;
+    static int _socket;
+    static slots_t *_threads, _retired;
+    static unsigned long _last_counters[__metric_counters];
+    static timespec _start_time, _last_time;
+    static pthread_mutex_t _mutex;
+
+    static void bump(std::atomic<unsigned long> &slot, unsigned long value) {
+        slot.store(slot.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+    }
+
+    static slots_t &local();
+    static void record(int histogram, unsigned long value);
+    static int bucket(unsigned long value);
+    static unsigned long bucket_value(int bucket);
+    static void merge(slots_t &dest, const slots_t &source);
+    static void *accept_clients();
+
+};
+
+#endif
@@ -0,0 +1,90 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "pool.h"
+#include "block.h"
+
+Pool::class_t Pool::_classes[__pool_classes] = {
+    {4 * 1024, 64, 0, NULL},
+    {64 * 1024, 16, 0, NULL},
+    {__block_size, 8, 0, NULL}
+};
+long Pool::_hits = 0, Pool::_misses = 0;
+pthread_mutex_t Pool::_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+unsigned char *Pool::acquire(int size, int &capacity) {
+
+    unsigned char *data = NULL;
+
+    for (int i = 0; i < __pool_classes; i++)
+        if (size <= _classes[i].size) {
+            capacity = _classes[i].size;
+            pthread_mutex_lock(&_mutex);
+            if (_classes[i].head) {
+                data = _classes[i].head;
+                _classes[i].head = *(unsigned char **) data;
+                _classes[i].count--;
+                _hits++;
+            } else
+                _misses++;
+            pthread_mutex_unlock(&_mutex);
+            if (!data)
+                data = new unsigned char[capacity];
+            return data;
+        }
+    pthread_mutex_lock(&_mutex);
+    _misses++;
+    pthread_mutex_unlock(&_mutex);
+    capacity = size;
+    return new unsigned char[capacity];
+}
+
+void Pool::release(unsigned char *data, int capacity) {
+    if (!data)
+        return;
+    for (int i = 0; i < __pool_classes; i++)
+        if (capacity == _classes[i].size) {
+            pthread_mutex_lock(&_mutex);
+            if (_classes[i].count < _classes[i].limit) {
+                *(unsigned char **) data = _classes[i].head;
+                _classes[i].head = data;
+                _classes[i].count++;
+                data = NULL;
+            }
+            pthread_mutex_unlock(&_mutex);
+            break;
+        }
+    delete[] data;
+}
+
+long Pool::hits() {
+
+    long hits;
+
+    pthread_mutex_lock(&_mutex);
+    hits = _hits;
+    pthread_mutex_unlock(&_mutex);
+    return hits;
+}
+
+long Pool::misses() {
+
+    long misses;
+
+    pthread_mutex_lock(&_mutex);
+    misses = _misses;
+    pthread_mutex_unlock(&_mutex);
+    return misses;
+}
@@ -0,0 +1,51 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef pool_h
+#define	pool_h
+
+#include <pthread.h>
+
+#define __pool_classes  3
+
+/*
+  Process wide free lists of block payload buffers. Buffers are grouped into
+  size classes so control and chat blocks don't pin a full sized buffer, and
+  each class keeps a bounded number of idle buffers to cap resident memory.
+  Requests larger than the biggest class bypass the pool.
+ */
+class Pool {
+public:
+
+    static unsigned char *acquire(int size, int &capacity);
+    static void release(unsigned char *data, int capacity);
+
+    static long hits();
+    static long misses();
+
+private:
+
+    struct class_t {
+        int size, limit, count;
+        unsigned char *head;
+    };
+
+    static class_t _classes[__pool_classes];
+    static long _hits, _misses;
+    static pthread_mutex_t _mutex;
+
+};
+
+#endif
@@ -0,0 +1,41 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "queue.h"
+
+Queue::Queue(int depth) : _slots(depth), _head(0), _tail(0) {
+}
+
+bool Queue::push(block_t &block) {
+
+    unsigned long tail = _tail.load(std::memory_order_relaxed);
+
+    if (tail - _head.load(std::memory_order_acquire) == _slots.size())
+        return false;
+    _slots[tail % _slots.size()].swap(block);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+}
+
+bool Queue::pop(block_t &block) {
+
+    unsigned long head = _head.load(std::memory_order_relaxed);
+
+    if (head == _tail.load(std::memory_order_acquire))
+        return false;
+    _slots[head % _slots.size()].swap(block);
+    _head.store(head + 1, std::memory_order_release);
+    return true;
+}
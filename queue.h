@@ -0,0 +1,54 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef queue_h
+#define	queue_h
+
+#include <vector>
+#include <atomic>
+#include "block.h"
+
+/*
+  Bounded lock-free queue of blocks for one consumer thread and one producer
+  at a time. Several threads may push only if the caller serialises them:
+  stream inboxes are fed by the event loop and the lane readers, which all
+  push under the transfer mutex. Blocks are swapped in and out of the slots
+  so ownership of the payload moves without copying. push and pop never
+  block, callers park themselves when the queue is full or empty.
+ */
+class Queue {
+public:
+
+    Queue(int depth);
+
+    bool push(block_t &block);
+    bool pop(block_t &block);
+
+    bool is_empty() const {
+        return _head.load(std::memory_order_relaxed) == _tail.load(std::memory_order_acquire);
+    }
+
+    bool is_full() const {
+        return _tail.load(std::memory_order_relaxed) - _head.load(std::memory_order_acquire) == _slots.size();
+    }
+
+private:
+
+    std::vector<block_t> _slots;
+    std::atomic<unsigned long> _head, _tail;
+
+};
+
+#endif
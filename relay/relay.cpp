@@ -0,0 +1,448 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "relay.h"
+
+Relay::Relay(int argc, char *argv[]) {
+
+    std::string string;
+
+    _port = -1;
+    _clients = _started = _next_id = 0;
+    _max_clients = __relay_clients;
+    _threads = sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_mutex_init(&_mutex, NULL);
+    try {
+        for (int i = 1; i < argc; i++) {
+            string = argv[i];
+            if (string == "-p" && i + 1 < argc)
+                _port = atoi(argv[++i]);
+            else if (string == "-c" && i + 1 < argc)
+                _max_clients = atoi(argv[++i]);
+            else if (string == "-t" && i + 1 < argc)
+                _threads = atoi(argv[++i]);
+            else
+                throw std::runtime_error("unknown argument " + string);
+        }
+        if (_port < 1 || _port > 65535)
+            throw std::runtime_error("invalid port number");
+        if (_max_clients < 2)
+            throw std::runtime_error("invalid number of clients");
+        if (_threads < 1)
+            throw std::runtime_error("invalid number of threads");
+    } catch (const std::exception &exception) {
+        std::cout << "SafeChat relay\n\n    -p <port> Specifies the port to listen on\n    -c <num>  Specifies the maximum number of connected clients\n    -t <num>  Specifies the number of event loop threads\n" << std::endl;
+        std::cerr << "Error: " << exception.what() << ".\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+Relay::~Relay() {
+    for (size_t i = 0; i < _sockets.size(); i++)
+        close(_sockets[i]);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void Relay::start() {
+
+    int value = 1, socket;
+    sockaddr_in addr;
+    rlimit limit;
+    std::vector<pthread_t> threads(_threads);
+
+    signal(SIGPIPE, SIG_IGN);
+    if (!getrlimit(RLIMIT_NOFILE, &limit)) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    try {
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_ANY);
+        addr.sin_port = htons(_port);
+        for (int i = 0; i < _threads; i++) {
+            socket = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+            _sockets.push_back(socket);
+            setsockopt(socket, SOL_SOCKET, SO_REUSEADDR, &value, sizeof value);
+            setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, &value, sizeof value);
+            if (bind(socket, (sockaddr *) & addr, sizeof addr) || listen(socket, SOMAXCONN))
+                throw std::runtime_error("can't listen on port");
+        }
+        for (int i = 0; i < _threads; i++)
+            if (pthread_create(&threads[i], NULL, &Relay::reactor, this))
+                throw std::runtime_error("can't start event loop");
+        std::cout << "Listening on port " << _port << " with " << _threads << " threads." << std::endl;
+        for (int i = 0; i < _threads; i++)
+            pthread_join(threads[i], NULL);
+    } catch (const std::exception &exception) {
+        std::cerr << "Error: " << exception.what() << ".\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+void *Relay::reactor() {
+
+    int socket = _sockets[_started++], epoll_fd = epoll_create1(0), events_size;
+    epoll_event event, events[__relay_events];
+    std::vector<connection_t *> closed;
+    connection_t *connection;
+
+    try {
+        event.events = EPOLLIN;
+        event.data.ptr = NULL;
+        if (epoll_fd < 0 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, socket, &event))
+            throw std::runtime_error("can't watch listening socket");
+        while (true) {
+            events_size = epoll_wait(epoll_fd, events, __relay_events, -1);
+            if (events_size < 0) {
+                if (errno == EINTR)
+                    continue;
+                throw std::runtime_error("can't wait for events");
+            }
+            for (int i = 0; i < events_size; i++) {
+                if (!events[i].data.ptr) {
+                    accept_clients(epoll_fd, socket);
+                    continue;
+                }
+                connection = ((handle_t *) events[i].data.ptr)->connection;
+                if (connection->state != __state_closed && !step(connection)) {
+                    release(connection);
+                    closed.push_back(connection);
+                }
+            }
+            for (size_t i = 0; i < closed.size(); i++)
+                delete closed[i];
+            closed.clear();
+        }
+    } catch (const std::exception &exception) {
+        std::cerr << "Error: " << exception.what() << ".\n";
+        exit(EXIT_FAILURE);
+    }
+    return NULL;
+}
+
+void Relay::accept_clients(int epoll_fd, int socket) {
+
+    int version[] = {__relay_version, __relay_transparent}, client, value = 1;
+    bool full;
+    std::string output;
+    epoll_event event;
+    connection_t *connection;
+
+    while ((client = accept4(socket, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+        full = ++_clients > _max_clients;
+        output.clear();
+        put_block(output, block_t(block_t::version, version, sizeof version));
+        put_block(output, block_t(block_t::full, &full, sizeof full));
+        if (full) {
+            send(client, output.data(), output.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            _clients--;
+            close(client);
+            continue;
+        }
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &value, sizeof value);
+        connection = new connection_t;
+        connection->state = __state_name;
+        connection->socket = client;
+        connection->output = output;
+        connection->out = connection->pipe[0] = connection->pipe[1] = -1;
+        connection->epoll_fd = epoll_fd;
+        connection->in_events = EPOLLIN;
+        connection->out_events = connection->pending = 0;
+        connection->paired = connection->closing = false;
+        connection->in_handle.connection = connection->out_handle.connection = connection;
+        event.events = EPOLLIN;
+        event.data.ptr = &connection->in_handle;
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, client, &event)) {
+            _clients--;
+            close(client);
+            delete connection;
+        } else if (!flush_output(connection)) {
+            release(connection);
+            delete connection;
+        }
+    }
+    if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED && errno != EMFILE && errno != ENFILE)
+        throw std::runtime_error("can't accept connection");
+}
+
+bool Relay::step(connection_t *connection) {
+    try {
+        switch (connection->state) {
+            case __state_name:
+            case __state_idle:
+                return read_commands(connection);
+            case __state_waiting:
+                return wait_for_peer(connection);
+            case __state_forward:
+                return forward(connection);
+        }
+    } catch (const std::exception &exception) {
+    }
+    return false;
+}
+
+bool Relay::read_commands(connection_t *connection) {
+
+    int id, hosts_size;
+    bool written;
+    std::map<int, std::string> hosts;
+    block_t block;
+
+    if (!read_input(connection))
+        return false;
+    while (next_block(connection, block)) {
+        if (connection->state == __state_name) {
+            if (block._cmd != block_t::name || !block._size)
+                return false;
+            block._data[block._size - 1] = 0;
+            connection->name = (char *) block._data;
+            connection->state = __state_idle;
+        } else if (block._cmd == block_t::add) {
+            pthread_mutex_lock(&_mutex);
+            connection->id = _next_id++;
+            _waiting[connection->id] = connection;
+            connection->state = __state_waiting;
+            written = flush_output(connection);
+            pthread_mutex_unlock(&_mutex);
+            return written;
+        } else if (block._cmd == block_t::list) {
+            pthread_mutex_lock(&_mutex);
+            for (std::map<int, connection_t *>::iterator waiting = _waiting.begin(); waiting != _waiting.end(); waiting++)
+                hosts[waiting->first] = waiting->second->name;
+            pthread_mutex_unlock(&_mutex);
+            hosts_size = hosts.size();
+            put_block(connection->output, block_t(block_t::list, &hosts_size, sizeof hosts_size));
+            for (std::map<int, std::string>::iterator host = hosts.begin(); host != hosts.end(); host++) {
+                put_block(connection->output, block_t(block_t::data, &host->first, sizeof host->first));
+                put_block(connection->output, block_t(block_t::data, host->second.c_str(), host->second.size() + 1));
+            }
+            hosts.clear();
+        } else if (block._cmd == block_t::connect && block._size == sizeof id) {
+            memcpy(&id, block._data, sizeof id);
+            if (pair(connection, id))
+                return start_forwarding(connection);
+            put_block(connection->output, block_t(block_t::unavailable));
+        } else if (block._cmd == block_t::disconnect)
+            return false;
+    }
+    return flush_output(connection);
+}
+
+bool Relay::wait_for_peer(connection_t *connection) {
+
+    bool readable;
+    block_t block;
+
+    pthread_mutex_lock(&_mutex);
+    if (connection->paired) {
+        pthread_mutex_unlock(&_mutex);
+        return start_forwarding(connection);
+    }
+    readable = read_input(connection) && flush_output(connection);
+    try {
+        while (next_block(connection, block));
+    } catch (const std::exception &exception) {
+        readable = false;
+    }
+    pthread_mutex_unlock(&_mutex);
+    return readable;
+}
+
+bool Relay::pair(connection_t *connection, int id) {
+
+    std::map<int, connection_t *>::iterator waiting;
+    connection_t *peer;
+    epoll_event event;
+
+    pthread_mutex_lock(&_mutex);
+    waiting = _waiting.find(id);
+    if (waiting == _waiting.end()) {
+        pthread_mutex_unlock(&_mutex);
+        return false;
+    }
+    peer = waiting->second;
+    _waiting.erase(waiting);
+    peer->paired = true;
+    peer->out = dup(connection->socket);
+    connection->out = dup(peer->socket);
+    put_block(peer->output, block_t(block_t::connect, connection->name.c_str(), connection->name.size() + 1));
+    put_block(connection->output, block_t(block_t::connect, peer->name.c_str(), peer->name.size() + 1));
+    connection->input.insert(0, peer->output);
+    peer->input.insert(0, connection->output);
+    peer->output.clear();
+    connection->output.clear();
+    event.events = peer->in_events = EPOLLIN | EPOLLOUT;
+    event.data.ptr = &peer->in_handle;
+    epoll_ctl(peer->epoll_fd, EPOLL_CTL_MOD, peer->socket, &event);
+    pthread_mutex_unlock(&_mutex);
+    if (connection->out < 0)
+        throw std::runtime_error("can't pair clients");
+    return true;
+}
+
+bool Relay::start_forwarding(connection_t *connection) {
+
+    epoll_event event;
+
+    connection->state = __state_forward;
+    if (connection->out < 0 || pipe2(connection->pipe, O_NONBLOCK))
+        return false;
+    fcntl(connection->pipe[1], F_SETPIPE_SZ, __relay_pipe_size);
+    connection->capacity = fcntl(connection->pipe[1], F_GETPIPE_SZ);
+    event.events = 0;
+    event.data.ptr = &connection->out_handle;
+    if (connection->capacity <= 0 || epoll_ctl(connection->epoll_fd, EPOLL_CTL_ADD, connection->out, &event))
+        return false;
+    return forward(connection);
+}
+
+bool Relay::forward(connection_t *connection) {
+
+    bool progress = true;
+    ssize_t bytes;
+
+    while (progress) {
+        progress = false;
+        if (connection->input.size()) {
+            bytes = send(connection->out, connection->input.data(), connection->input.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+                return false;
+            if (bytes > 0) {
+                connection->input.erase(0, bytes);
+                progress = true;
+            }
+        }
+        if (!connection->closing && connection->pending < connection->capacity) {
+            bytes = splice(connection->socket, NULL, connection->pipe[1], NULL, connection->capacity - connection->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (!bytes)
+                connection->closing = true;
+            else if (bytes > 0) {
+                connection->pending += bytes;
+                progress = true;
+            } else if (errno != EAGAIN && errno != EINTR)
+                return false;
+        }
+        if (connection->pending && connection->input.empty()) {
+            bytes = splice(connection->pipe[0], NULL, connection->out, NULL, connection->pending, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (bytes > 0) {
+                connection->pending -= bytes;
+                progress = true;
+            } else if (bytes < 0 && errno != EAGAIN && errno != EINTR)
+                return false;
+        }
+    }
+    if (connection->closing && !connection->pending && connection->input.empty())
+        return false;
+    watch(connection, !connection->closing && connection->pending < connection->capacity ? EPOLLIN : 0, connection->pending || connection->input.size() ? EPOLLOUT : 0);
+    return true;
+}
+
+void Relay::watch(connection_t *connection, unsigned int in_events, unsigned int out_events) {
+
+    epoll_event event;
+
+    if (connection->in_events != in_events) {
+        event.events = connection->in_events = in_events;
+        event.data.ptr = &connection->in_handle;
+        epoll_ctl(connection->epoll_fd, EPOLL_CTL_MOD, connection->socket, &event);
+    }
+    if (connection->out_events != out_events) {
+        event.events = connection->out_events = out_events;
+        event.data.ptr = &connection->out_handle;
+        epoll_ctl(connection->epoll_fd, EPOLL_CTL_MOD, connection->out, &event);
+    }
+}
+
+void Relay::release(connection_t *connection) {
+    pthread_mutex_lock(&_mutex);
+    if (connection->state == __state_waiting && !connection->paired)
+        _waiting.erase(connection->id);
+    pthread_mutex_unlock(&_mutex);
+    epoll_ctl(connection->epoll_fd, EPOLL_CTL_DEL, connection->socket, NULL);
+    close(connection->socket);
+    if (connection->out >= 0) {
+        if (connection->state == __state_forward)
+            epoll_ctl(connection->epoll_fd, EPOLL_CTL_DEL, connection->out, NULL);
+        shutdown(connection->out, SHUT_RDWR);
+        close(connection->out);
+    }
+    if (connection->pipe[0] >= 0) {
+        close(connection->pipe[0]);
+        close(connection->pipe[1]);
+    }
+    connection->state = __state_closed;
+    _clients--;
+}
+
+bool Relay::read_input(connection_t *connection) {
+
+    char buffer[__relay_read_size];
+    ssize_t bytes;
+
+    while (true) {
+        bytes = recv(connection->socket, buffer, sizeof buffer, 0);
+        if (bytes > 0)
+            connection->input.append(buffer, bytes);
+        else if (bytes < 0 && errno == EINTR)
+            continue;
+        else
+            return bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+    }
+}
+
+bool Relay::next_block(connection_t *connection, block_t &dest) {
+
+    int header_size = sizeof dest._cmd + sizeof dest._size, size;
+
+    if ((int) connection->input.size() < header_size)
+        return false;
+    memcpy(&size, connection->input.data() + sizeof dest._cmd, sizeof size);
+    if (size < 0 || size > __block_size)
+        throw std::runtime_error("oversized block received");
+    if ((int) connection->input.size() < header_size + size)
+        return false;
+    memcpy(&dest._cmd, connection->input.data(), sizeof dest._cmd);
+    dest.reserve(size);
+    dest._size = size;
+    memcpy(dest._data, connection->input.data() + header_size, size);
+    connection->input.erase(0, header_size + size);
+    return true;
+}
+
+bool Relay::flush_output(connection_t *connection) {
+
+    ssize_t bytes;
+
+    while (connection->output.size()) {
+        bytes = send(connection->socket, connection->output.data(), connection->output.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (bytes > 0)
+            connection->output.erase(0, bytes);
+        else if (bytes < 0 && errno == EINTR)
+            continue;
+        else if (bytes < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        else
+            return false;
+    }
+    watch(connection, connection->output.size() ? EPOLLIN | EPOLLOUT : EPOLLIN, 0);
+    return true;
+}
+
+void Relay::put_block(std::string &dest, const block_t &source) {
+    dest.append((const char *) &source._cmd, sizeof source._cmd);
+    dest.append((const char *) &source._size, sizeof source._size);
+    dest.append((const char *) source._data, source._size);
+}
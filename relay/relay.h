@@ -0,0 +1,119 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef relay_h
+#define	relay_h
+
+#include <map>
+#include <vector>
+#include <atomic>
+#include <string>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include "block.h"
+
+#define __relay_version     4
+#define __relay_transparent 0x1
+#define __relay_clients     16384
+#define __relay_events      256
+#define __relay_read_size   4096
+#define __relay_pipe_size   256 * 1024
+
+#define __state_name        0
+#define __state_idle        1
+#define __state_waiting     2
+#define __state_forward     3
+#define __state_closed      4
+
+/*
+  Stand-in for the SafeChat server. Clients are matched with the version,
+  full, name, add, list and connect exchange, after which the relay moves
+  bytes between the pair without parsing them, which it advertises with the
+  transparent flag after the version number.
+
+  Each thread runs its own epoll loop on its own SO_REUSEPORT listening
+  socket, so the kernel spreads connections over the threads. Only the
+  table of waiting clients is shared. Every connection owns the direction
+  from its client to its peer and moves it with splice through a pipe; at
+  pairing time each side gets a dup of the other's socket so both
+  directions can be driven from whichever thread owns the reading side.
+  Replies to commands are queued on the connection and flushed when its
+  socket is writable, and the connect notices of a new pair are put in
+  front of the bytes each direction will forward, so no thread ever
+  blocks on a slow client.
+ */
+class Relay {
+public:
+
+    Relay(int argc, char *argv[]);
+    ~Relay();
+
+    void start();
+
+    static void *reactor(void *relay) {
+        return ((Relay *) relay)->reactor();
+    }
+
+private:
+
+    struct connection_t;
+
+    struct handle_t {
+        connection_t *connection;
+    };
+
+    struct connection_t {
+        int state, id, socket, out, epoll_fd, pipe[2], pending, capacity;
+        unsigned int in_events, out_events;
+        bool paired, closing;
+        std::string input, output, name;
+        handle_t in_handle, out_handle;
+    };
+
+    int _port, _threads, _max_clients, _next_id;
+    std::atomic<int> _clients, _started;
+    std::vector<int> _sockets;
+    std::map<int, connection_t *> _waiting;
+    pthread_mutex_t _mutex;
+
+    void *reactor();
+    void accept_clients(int epoll_fd, int socket);
+    bool step(connection_t *connection);
+    bool read_commands(connection_t *connection);
+    bool wait_for_peer(connection_t *connection);
+    bool pair(connection_t *connection, int id);
+    bool start_forwarding(connection_t *connection);
+    bool forward(connection_t *connection);
+    void watch(connection_t *connection, unsigned int in_events, unsigned int out_events);
+    void release(connection_t *connection);
+    bool read_input(connection_t *connection);
+    bool next_block(connection_t *connection, block_t &dest);
+    bool flush_output(connection_t *connection);
+    void put_block(std::string &dest, const block_t &source);
+
+};
+
+#endif
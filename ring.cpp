@@ -0,0 +1,69 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "ring.h"
+
+Ring::Ring(int depth) : _slots(depth) {
+    _closed = false;
+    _head = _count = 0;
+    pthread_cond_init(&_not_empty, NULL);
+    pthread_cond_init(&_not_full, NULL);
+    pthread_mutex_init(&_mutex, NULL);
+}
+
+Ring::~Ring() {
+    pthread_cond_destroy(&_not_empty);
+    pthread_cond_destroy(&_not_full);
+    pthread_mutex_destroy(&_mutex);
+}
+
+bool Ring::push(block_t &block) {
+    pthread_mutex_lock(&_mutex);
+    while (_count == (int) _slots.size() && !_closed)
+        pthread_cond_wait(&_not_full, &_mutex);
+    if (_closed) {
+        pthread_mutex_unlock(&_mutex);
+        return false;
+    }
+    _slots[(_head + _count) % _slots.size()].swap(block);
+    _count++;
+    pthread_cond_signal(&_not_empty);
+    pthread_mutex_unlock(&_mutex);
+    return true;
+}
+
+bool Ring::pop(block_t &block) {
+    pthread_mutex_lock(&_mutex);
+    while (!_count && !_closed)
+        pthread_cond_wait(&_not_empty, &_mutex);
+    if (!_count) {
+        pthread_mutex_unlock(&_mutex);
+        return false;
+    }
+    _slots[_head].swap(block);
+    _head = (_head + 1) % _slots.size();
+    _count--;
+    pthread_cond_signal(&_not_full);
+    pthread_mutex_unlock(&_mutex);
+    return true;
+}
+
+void Ring::close() {
+    pthread_mutex_lock(&_mutex);
+    _closed = true;
+    pthread_cond_broadcast(&_not_empty);
+    pthread_cond_broadcast(&_not_full);
+    pthread_mutex_unlock(&_mutex);
+}
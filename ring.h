@@ -0,0 +1,48 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef ring_h
+#define	ring_h
+
+#include <vector>
+#include <pthread.h>
+#include "block.h"
+
+/*
+  Bounded queue of blocks connecting two pipeline stages. Blocks are swapped
+  in and out of the slots, so payload buffers circulate between the stages
+  instead of being copied, and a full ring blocks the producer.
+ */
+class Ring {
+public:
+
+    Ring(int depth);
+    ~Ring();
+
+    bool push(block_t &block);
+    bool pop(block_t &block);
+    void close();
+
+private:
+
+    bool _closed;
+    int _head, _count;
+    std::vector<block_t> _slots;
+    pthread_cond_t _not_empty, _not_full;
+    pthread_mutex_t _mutex;
+
+};
+
+#endif
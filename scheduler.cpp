@@ -0,0 +1,59 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "scheduler.h"
+
+Scheduler::Scheduler() {
+    _urgent = 0;
+    _next_ticket = _serving = 0;
+    pthread_cond_init(&_cond, NULL);
+    pthread_mutex_init(&_mutex, NULL);
+}
+
+Scheduler::~Scheduler() {
+    pthread_cond_destroy(&_cond);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void Scheduler::begin_bulk() {
+
+    unsigned long ticket;
+
+    pthread_mutex_lock(&_mutex);
+    ticket = _next_ticket++;
+    while (ticket != _serving || _urgent)
+        pthread_cond_wait(&_cond, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Scheduler::end_bulk() {
+    pthread_mutex_lock(&_mutex);
+    _serving++;
+    pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Scheduler::begin_urgent() {
+    pthread_mutex_lock(&_mutex);
+    _urgent++;
+    pthread_mutex_unlock(&_mutex);
+}
+
+void Scheduler::end_urgent() {
+    pthread_mutex_lock(&_mutex);
+    if (!--_urgent)
+        pthread_cond_broadcast(&_cond);
+    pthread_mutex_unlock(&_mutex);
+}
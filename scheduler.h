@@ -0,0 +1,47 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef scheduler_h
+#define	scheduler_h
+
+#include <pthread.h>
+
+/*
+  Orders socket writes between the streams of a session. Bulk writers take
+  a ticket and write strictly in ticket order, so streams with data queued
+  get one chunk each in turn, and they all stand aside while any urgent
+  writer such as chat or flow control is waiting for the socket.
+ */
+class Scheduler {
+public:
+
+    Scheduler();
+    ~Scheduler();
+
+    void begin_bulk();
+    void end_bulk();
+    void begin_urgent();
+    void end_urgent();
+
+private:
+
+    int _urgent;
+    unsigned long _next_ticket, _serving;
+    pthread_cond_t _cond;
+    pthread_mutex_t _mutex;
+
+};
+
+#endif
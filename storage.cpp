@@ -0,0 +1,343 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "storage.h"
+
+std::atomic<long> Storage::_syscalls(0);
+
+Storage::Storage() {
+    _preallocate = true;
+    _direct = false;
+    _mode = __storage_buffered;
+    _fd = _tail_fd = -1;
+    _staged = 0;
+    _offset = _size = _staged_offset = _released = 0;
+    _head = _queued = _unit = 0;
+    _next = 0;
+    _map = NULL;
+    if (posix_memalign((void **) &_staging, __storage_align, __storage_window))
+        throw std::runtime_error("can't allocate staging buffer");
+    for (int i = 0; i < __storage_slots; i++)
+        _slots[i] = NULL;
+}
+
+Storage::~Storage() {
+    close();
+    _uring.teardown();
+    free(_staging);
+    for (int i = 0; i < __storage_slots; i++)
+        free(_slots[i]);
+}
+
+void Storage::set_mode(int mode) {
+    _mode = mode;
+    if (_mode != __storage_uring || _uring.is_ready())
+        return;
+    for (int i = 0; i < __storage_slots; i++)
+        if (!_slots[i] && posix_memalign((void **) &_slots[i], __storage_align, __block_size))
+            throw std::runtime_error("can't allocate staging buffer");
+    _uring.setup(2 * __storage_slots, _slots, __storage_slots, __block_size);
+}
+
+void Storage::set_preallocate(bool preallocate) {
+    _preallocate = preallocate;
+}
+
+int Storage::mode() const {
+    return _mode;
+}
+
+bool Storage::is_preallocating() const {
+    return _preallocate;
+}
+
+void Storage::open_read(const std::string &path, long offset) {
+
+    struct stat info;
+
+    close();
+    if ((_fd = open_file(path, O_RDONLY)) < 0 || fstat(_fd, &info))
+        throw std::runtime_error("can't read file");
+    _size = info.st_size;
+    _offset = _released = _next = offset;
+    _staged = 0;
+    if (_mode == __storage_mmap && _size) {
+        _map = (unsigned char *) mmap(NULL, _size, PROT_READ, MAP_SHARED, _fd, 0);
+        if (_map == MAP_FAILED) {
+            _map = NULL;
+            throw std::runtime_error("can't map file");
+        }
+        madvise(_map, _size, MADV_SEQUENTIAL);
+    } else
+        posix_fadvise(_fd, offset, 0, POSIX_FADV_SEQUENTIAL);
+}
+
+void Storage::open_write(const std::string &path, long offset, long size) {
+    close();
+    if ((_fd = open_file(path, O_WRONLY)) < 0)
+        throw std::runtime_error("can't write file");
+    if (_preallocate && size > offset)
+        fallocate(_fd, FALLOC_FL_KEEP_SIZE, offset, size - offset);
+    _size = size;
+    _offset = _released = offset;
+    if (_direct) {
+        _staged_offset = offset & ~(long) (__storage_align - 1);
+        _staged = offset - _staged_offset;
+        if ((_tail_fd = open(path.c_str(), O_RDWR)) < 0 || !pread_all(_tail_fd, _staging, _staged, _staged_offset))
+            throw std::runtime_error("can't write file");
+    }
+}
+
+bool Storage::read(block_t &dest, int size) {
+
+    int count;
+
+    dest.reserve(size);
+    dest._size = size;
+    if (_offset + size > _size)
+        return false;
+    if (_uring.is_ready() && !_queued && _next == _offset) {
+        _unit = size;
+        queue_reads();
+    }
+    if (_map)
+        memcpy(dest._data, _map + _offset, size);
+    else if (_queued && _slot_offset[_head] == _offset && _slot_size[_head] == size) {
+        if (!wait_slot(_head) || _slot_result[_head] != size)
+            return false;
+        memcpy(dest._data, _slots[_head], size);
+        _head = (_head + 1) % __storage_slots;
+        _queued--;
+        if (_queued <= __storage_slots / 2)
+            queue_reads();
+    } else if (_direct)
+        for (int done = 0; done < size; done += count) {
+            if (_offset + done < _staged_offset || _offset + done >= _staged_offset + _staged) {
+                _staged_offset = (_offset + done) & ~(long) (__storage_align - 1);
+                _syscalls++;
+                if ((_staged = pread(_fd, _staging, __storage_window, _staged_offset)) <= _offset + done - _staged_offset) {
+                    _staged = 0;
+                    return false;
+                }
+            }
+            count = std::min((long) size - done, _staged_offset + _staged - _offset - done);
+            memcpy(dest._data + done, _staging + _offset + done - _staged_offset, count);
+        }
+    else if (!pread_all(_fd, dest._data, size, _offset))
+        return false;
+    _offset += size;
+    release();
+    return true;
+}
+
+bool Storage::write(const block_t &source) {
+
+    int slot;
+    long aligned;
+
+    if (_uring.is_ready() && source._size && source._size <= __block_size) {
+        if (_queued == __storage_slots) {
+            if (!wait_slot(_head) || _slot_result[_head] != _slot_size[_head])
+                return false;
+            _head = (_head + 1) % __storage_slots;
+            _queued--;
+        }
+        slot = (_head + _queued) % __storage_slots;
+        memcpy(_slots[slot], source._data, source._size);
+        _slot_offset[slot] = _offset;
+        _slot_size[slot] = source._size;
+        _slot_done[slot] = false;
+        if (!_uring.prepare(IORING_OP_WRITE, _fd, slot, _slots[slot], source._size, _offset, slot))
+            return false;
+        _queued++;
+        _offset += source._size;
+        if (_uring.pending() < __storage_slots / 2)
+            return true;
+        _syscalls++;
+        return _uring.submit(false);
+    }
+    if (!_direct) {
+        if (!pwrite_all(_fd, source._data, source._size, _offset))
+            return false;
+        _offset += source._size;
+        if (_mode == __storage_direct) {
+            sync_file_range(_fd, _released, _offset - _released, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+            release();
+        }
+        return true;
+    }
+    memcpy(_staging + _staged, source._data, source._size);
+    _staged += source._size;
+    _offset += source._size;
+    aligned = _staged & ~(__storage_align - 1);
+    if (aligned) {
+        if (!pwrite_all(_fd, _staging, aligned, _staged_offset))
+            return false;
+        _staged -= aligned;
+        _staged_offset += aligned;
+        memmove(_staging, _staging + aligned, _staged);
+    }
+    return !_staged || pwrite_all(_tail_fd, _staging, _staged, _staged_offset);
+}
+
+bool Storage::flush() {
+
+    bool flushed = true;
+
+    while (_queued) {
+        if (!wait_slot(_head) || _slot_result[_head] != _slot_size[_head])
+            flushed = false;
+        _head = (_head + 1) % __storage_slots;
+        _queued--;
+    }
+    return flushed;
+}
+
+void Storage::close() {
+    flush();
+    if (_map)
+        munmap(_map, _size);
+    if (_fd >= 0)
+        ::close(_fd);
+    if (_tail_fd >= 0)
+        ::close(_tail_fd);
+    _map = NULL;
+    _fd = _tail_fd = -1;
+    _direct = false;
+}
+
+int Storage::mode_id(const std::string &name) {
+    if (name == "buffered")
+        return __storage_buffered;
+    if (name == "mmap")
+        return __storage_mmap;
+    if (name == "direct")
+        return __storage_direct;
+    if (name == "uring")
+        return __storage_uring;
+    throw std::runtime_error("unknown file I/O engine " + name);
+}
+
+std::string Storage::mode_name(int id) {
+    switch (id) {
+        case __storage_buffered:
+            return "buffered";
+        case __storage_mmap:
+            return "mmap";
+        case __storage_direct:
+            return "direct";
+        case __storage_uring:
+            return "uring";
+    }
+    throw std::runtime_error("unknown file I/O engine");
+}
+
+long Storage::syscalls() {
+    return _syscalls;
+}
+
+int Storage::open_file(const std::string &path, int flags) {
+
+    int fd = -1;
+
+    if (_mode == __storage_direct)
+        fd = open(path.c_str(), flags | O_DIRECT);
+    _direct = fd >= 0;
+    if (fd < 0)
+        fd = open(path.c_str(), flags);
+    return fd;
+}
+
+bool Storage::pread_all(int fd, unsigned char *data, long size, long offset) {
+
+    long count;
+
+    while (size > 0) {
+        _syscalls++;
+        if ((count = pread(fd, data, size, offset)) <= 0)
+            return false;
+        data += count;
+        size -= count;
+        offset += count;
+    }
+    return true;
+}
+
+bool Storage::pwrite_all(int fd, const unsigned char *data, long size, long offset) {
+
+    long count;
+
+    while (size > 0) {
+        _syscalls++;
+        if ((count = pwrite(fd, data, size, offset)) < 0)
+            return false;
+        data += count;
+        size -= count;
+        offset += count;
+    }
+    return true;
+}
+
+void Storage::release() {
+
+    long start = _released & ~(long) (__storage_align - 1), end = _offset & ~(long) (__storage_align - 1);
+
+    if ((_mode != __storage_mmap && _mode != __storage_direct) || end - start < __block_size)
+        return;
+    if (_map)
+        madvise(_map + start, end - start, MADV_DONTNEED);
+    posix_fadvise(_fd, start, end - start, POSIX_FADV_DONTNEED);
+    _released = end;
+}
+
+void Storage::queue_reads() {
+
+    int slot, size, count = 0;
+
+    while (_queued < __storage_slots && _next < _size && _unit) {
+        slot = (_head + _queued) % __storage_slots;
+        size = std::min(_size - _next, (long) _unit);
+        if (!_uring.prepare(IORING_OP_READ, _fd, slot, _slots[slot], size, _next, slot))
+            break;
+        _slot_offset[slot] = _next;
+        _slot_size[slot] = size;
+        _slot_done[slot] = false;
+        _next += size;
+        _queued++;
+        count++;
+    }
+    if (count) {
+        _syscalls++;
+        _uring.submit(false);
+    }
+}
+
+bool Storage::wait_slot(int slot) {
+
+    unsigned long tag;
+    int result;
+
+    while (true) {
+        while (_uring.complete(tag, result)) {
+            _slot_result[tag] = result;
+            _slot_done[tag] = true;
+        }
+        if (_slot_done[slot])
+            return true;
+        _syscalls++;
+        if (!_uring.submit(true))
+            return false;
+    }
+}
@@ -0,0 +1,92 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef storage_h
+#define	storage_h
+
+#include <string>
+#include <atomic>
+#include <stdexcept>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "block.h"
+#include "uring.h"
+
+#define __storage_buffered  0
+#define __storage_mmap      1
+#define __storage_direct    2
+#define __storage_uring     3
+#define __storage_slots     8
+#define __storage_align     4096
+#define __storage_window    2 * __block_size
+
+/*
+  Positional file I/O for the bulk of a transfer. The buffered engine uses
+  plain pread and pwrite, the mmap engine copies outgoing blocks straight
+  out of a sequentially advised mapping, and the direct engine goes through
+  an aligned staging buffer with O_DIRECT so multi gigabyte transfers don't
+  evict the page cache. Both of the latter drop pages behind the current
+  position. The io_uring engine keeps a window of reads ahead of the sender
+  and writes behind the receiver in flight against registered buffers, and
+  falls back to the buffered engine where io_uring is unavailable. Received
+  files are preallocated with fallocate.
+ */
+class Storage {
+public:
+
+    Storage();
+    ~Storage();
+
+    void set_mode(int mode);
+    void set_preallocate(bool preallocate);
+    int mode() const;
+    bool is_preallocating() const;
+    void open_read(const std::string &path, long offset);
+    void open_write(const std::string &path, long offset, long size);
+    bool read(block_t &dest, int size);
+    bool write(const block_t &source);
+    bool flush();
+    void close();
+
+    static int mode_id(const std::string &name);
+    static std::string mode_name(int id);
+    static long syscalls();
+
+private:
+
+    bool _preallocate, _direct;
+    bool _slot_done[__storage_slots];
+    int _mode, _fd, _tail_fd, _staged, _head, _queued, _unit, _slot_size[__storage_slots], _slot_result[__storage_slots];
+    long _offset, _size, _staged_offset, _released, _next, _slot_offset[__storage_slots];
+    unsigned char *_map, *_staging, *_slots[__storage_slots];
+    Uring _uring;
+
+    static std::atomic<long> _syscalls;
+
+    int open_file(const std::string &path, int flags);
+    bool pread_all(int fd, unsigned char *data, long size, long offset);
+    bool pwrite_all(int fd, const unsigned char *data, long size, long offset);
+    void release();
+    void queue_reads();
+    bool wait_slot(int slot);
+
+};
+
+#endif
@@ -0,0 +1,164 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "tickets.h"
+
+Tickets::~Tickets() {
+    clear();
+}
+
+void Tickets::load(const std::string &path) {
+
+    std::ifstream file(path.c_str(), std::ifstream::binary);
+    std::string sealed((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>()), data, line, secret, peer;
+    std::istringstream lines;
+    ticket_t ticket;
+    time_t now = time(NULL);
+
+    clear();
+    _path = path;
+    if (!decrypt(data, sealed))
+        return;
+    lines.str(data);
+    OPENSSL_cleanse(&data[0], data.size());
+    while (std::getline(lines, line)) {
+        std::istringstream fields(line);
+
+        if (!(fields >> ticket._expiry >> secret) || ticket._expiry <= now || fields.get() != ' ' || !std::getline(fields, peer))
+            continue;
+        ticket._secret = Manifest::from_hex(secret);
+        if (ticket._secret.size() == __ticket_size)
+            _tickets[peer] = ticket;
+        OPENSSL_cleanse(&secret[0], secret.size());
+    }
+    OPENSSL_cleanse(&line[0], line.size());
+}
+
+bool Tickets::find(const std::string &peer, std::string &secret) const {
+
+    std::map<std::string, ticket_t>::const_iterator it = _tickets.find(peer);
+
+    if (it == _tickets.end() || it->second._expiry <= time(NULL))
+        return false;
+    secret = it->second._secret;
+    return true;
+}
+
+void Tickets::store(const std::string &peer, const std::string &secret, time_t expiry) {
+    _tickets[peer]._secret = secret;
+    _tickets[peer]._expiry = expiry;
+    save();
+}
+
+void Tickets::remove(const std::string &peer) {
+    if (_tickets.erase(peer))
+        save();
+}
+
+void Tickets::save() {
+
+    bool ok;
+    int fd;
+    std::string temp = _path + ".tmp", data, sealed;
+    std::map<std::string, ticket_t>::const_iterator it;
+
+    if (_path.empty())
+        return;
+    for (it = _tickets.begin(); it != _tickets.end(); ++it)
+        data += std::to_string((long) it->second._expiry) + " " + Manifest::to_hex(it->second._secret) + " " + it->first + "\n";
+    ok = encrypt(sealed, data);
+    OPENSSL_cleanse(&data[0], data.size());
+    if (!ok) {
+        unlink(_path.c_str());
+        return;
+    }
+    if ((fd = open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        return;
+    ok = write(fd, sealed.data(), sealed.size()) == (ssize_t) sealed.size();
+    if (close(fd) || !ok || rename(temp.c_str(), _path.c_str()))
+        unlink(temp.c_str());
+}
+
+void Tickets::clear() {
+
+    std::map<std::string, ticket_t>::iterator it;
+
+    for (it = _tickets.begin(); it != _tickets.end(); ++it)
+        OPENSSL_cleanse(&it->second._secret[0], it->second._secret.size());
+    _tickets.clear();
+}
+
+bool Tickets::get_key(unsigned char *key, bool create) const {
+
+    long id;
+    std::string name = "safechat:" + _path;
+    unsigned char fresh[__ticket_key_size];
+
+    id = syscall(SYS_request_key, "user", name.c_str(), NULL, KEY_SPEC_USER_KEYRING);
+    if (id < 0 && create) {
+        RAND_bytes(fresh, sizeof fresh);
+        id = syscall(SYS_add_key, "user", name.c_str(), fresh, sizeof fresh, KEY_SPEC_USER_KEYRING);
+        OPENSSL_cleanse(fresh, sizeof fresh);
+    }
+    return id >= 0 && syscall(SYS_keyctl, KEYCTL_READ, id, key, __ticket_key_size) == __ticket_key_size;
+}
+
+bool Tickets::encrypt(std::string &dest, const std::string &source) const {
+
+    bool ok;
+    int size;
+    unsigned char key[__ticket_key_size], *data;
+    EVP_CIPHER_CTX *context;
+
+    if (!get_key(key, true))
+        return false;
+    dest.resize(__ticket_nonce_size + source.size() + __ticket_tag_size);
+    data = (unsigned char *) &dest[0];
+    RAND_bytes(data, __ticket_nonce_size);
+    context = EVP_CIPHER_CTX_new();
+    ok = EVP_EncryptInit_ex(context, EVP_aes_256_gcm(), NULL, key, data) &&
+            EVP_EncryptUpdate(context, data + __ticket_nonce_size, &size, (const unsigned char *) source.data(), source.size()) &&
+            EVP_EncryptFinal_ex(context, data + __ticket_nonce_size + size, &size) &&
+            EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_GET_TAG, __ticket_tag_size, data + dest.size() - __ticket_tag_size);
+    EVP_CIPHER_CTX_free(context);
+    OPENSSL_cleanse(key, sizeof key);
+    return ok;
+}
+
+bool Tickets::decrypt(std::string &dest, const std::string &source) const {
+
+    bool ok;
+    int size;
+    unsigned char key[__ticket_key_size], tag[__ticket_tag_size];
+    const unsigned char *data = (const unsigned char *) source.data();
+    EVP_CIPHER_CTX *context;
+
+    if (source.size() < __ticket_nonce_size + __ticket_tag_size || !get_key(key, false))
+        return false;
+    dest.resize(source.size() - __ticket_nonce_size - __ticket_tag_size);
+    memcpy(tag, data + source.size() - __ticket_tag_size, sizeof tag);
+    context = EVP_CIPHER_CTX_new();
+    ok = EVP_DecryptInit_ex(context, EVP_aes_256_gcm(), NULL, key, data) &&
+            EVP_DecryptUpdate(context, (unsigned char *) &dest[0], &size, data + __ticket_nonce_size, dest.size()) &&
+            EVP_CIPHER_CTX_ctrl(context, EVP_CTRL_GCM_SET_TAG, sizeof tag, tag) &&
+            EVP_DecryptFinal_ex(context, (unsigned char *) &dest[0] + size, &size);
+    EVP_CIPHER_CTX_free(context);
+    OPENSSL_cleanse(key, sizeof key);
+    if (!ok) {
+        OPENSSL_cleanse(&dest[0], dest.size());
+        dest.clear();
+    }
+    return ok;
+}
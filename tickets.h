@@ -0,0 +1,76 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef tickets_h
+#define	tickets_h
+
+#include <map>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/keyctl.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include "manifest.h"
+
+#define __ticket_ttl    86400
+#define __ticket_key_size   32
+#define __ticket_nonce_size 12
+#define __ticket_tag_size   16
+
+/*
+  Resumption secrets left behind by earlier sessions, one per peer name.
+  The cache file is sealed with AES-256-GCM under a random key that lives
+  only in the user's kernel keyring, so a copy of the file alone resumes
+  nothing. Without a usable keyring the tickets stay in memory. A ticket
+  is taken out of the cache as soon as a handshake uses it, and each
+  handshake leaves a fresh one, so no secret ever keys more than one
+  resumed session.
+ */
+class Tickets {
+public:
+
+    struct ticket_t {
+        std::string _secret;
+        time_t _expiry;
+    };
+
+    ~Tickets();
+
+    void load(const std::string &path);
+    bool find(const std::string &peer, std::string &secret) const;
+    void store(const std::string &peer, const std::string &secret, time_t expiry);
+    void remove(const std::string &peer);
+
+private:
+
+    std::string _path;
+    std::map<std::string, ticket_t> _tickets;
+
+    void save();
+    void clear();
+    bool get_key(unsigned char *key, bool create) const;
+    bool encrypt(std::string &dest, const std::string &source) const;
+    bool decrypt(std::string &dest, const std::string &source) const;
+
+};
+
+#endif
@@ -0,0 +1,156 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#include "uring.h"
+
+Uring::Uring() {
+    _fixed = false;
+    _fd = -1;
+    _pending = 0;
+    _sq_ring = _cq_ring = NULL;
+    _sqes = NULL;
+}
+
+Uring::~Uring() {
+    teardown();
+}
+
+bool Uring::setup(int entries, unsigned char **buffers, int count, int size) {
+
+    io_uring_params params;
+    std::vector<iovec> iov(count);
+
+    memset(&params, 0, sizeof params);
+    if ((_fd = syscall(__NR_io_uring_setup, entries, &params)) < 0)
+        return false;
+    _sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    _cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        _sq_size = _cq_size = std::max(_sq_size, _cq_size);
+    _sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    _sq_ring = (unsigned char *) mmap(NULL, _sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQ_RING);
+    if (_sq_ring == MAP_FAILED) {
+        _sq_ring = NULL;
+        teardown();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+        _cq_ring = _sq_ring;
+    else if ((_cq_ring = (unsigned char *) mmap(NULL, _cq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        _cq_ring = NULL;
+        teardown();
+        return false;
+    }
+    _sqes = (io_uring_sqe *) mmap(NULL, _sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd, IORING_OFF_SQES);
+    if (_sqes == MAP_FAILED) {
+        _sqes = NULL;
+        teardown();
+        return false;
+    }
+    _sq_head = (unsigned *) (_sq_ring + params.sq_off.head);
+    _sq_tail = (unsigned *) (_sq_ring + params.sq_off.tail);
+    _sq_mask = (unsigned *) (_sq_ring + params.sq_off.ring_mask);
+    _sq_array = (unsigned *) (_sq_ring + params.sq_off.array);
+    _cq_head = (unsigned *) (_cq_ring + params.cq_off.head);
+    _cq_tail = (unsigned *) (_cq_ring + params.cq_off.tail);
+    _cq_mask = (unsigned *) (_cq_ring + params.cq_off.ring_mask);
+    _cqes = (io_uring_cqe *) (_cq_ring + params.cq_off.cqes);
+    for (int i = 0; i < count; i++) {
+        iov[i].iov_base = buffers[i];
+        iov[i].iov_len = size;
+    }
+    _fixed = count && !syscall(__NR_io_uring_register, _fd, IORING_REGISTER_BUFFERS, &iov[0], count);
+    _pending = 0;
+    return true;
+}
+
+void Uring::teardown() {
+    if (_sqes)
+        munmap(_sqes, _sqes_size);
+    if (_cq_ring && _cq_ring != _sq_ring)
+        munmap(_cq_ring, _cq_size);
+    if (_sq_ring)
+        munmap(_sq_ring, _sq_size);
+    if (_fd >= 0)
+        close(_fd);
+    _sq_ring = _cq_ring = NULL;
+    _sqes = NULL;
+    _fd = -1;
+    _fixed = false;
+}
+
+bool Uring::is_ready() const {
+    return _fd >= 0;
+}
+
+unsigned Uring::pending() const {
+    return _pending;
+}
+
+bool Uring::prepare(int op, int fd, int buffer, unsigned char *data, int size, long offset, unsigned long tag) {
+
+    unsigned tail = *_sq_tail, index;
+    io_uring_sqe *sqe;
+
+    if (tail - __atomic_load_n(_sq_head, __ATOMIC_ACQUIRE) > *_sq_mask)
+        return false;
+    index = tail & *_sq_mask;
+    sqe = &_sqes[index];
+    memset(sqe, 0, sizeof *sqe);
+    if (_fixed && op == IORING_OP_READ) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = buffer;
+    } else if (_fixed && op == IORING_OP_WRITE) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->buf_index = buffer;
+    } else
+        sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (unsigned long) data;
+    sqe->len = size;
+    sqe->off = offset;
+    sqe->user_data = tag;
+    _sq_array[index] = index;
+    __atomic_store_n(_sq_tail, tail + 1, __ATOMIC_RELEASE);
+    _pending++;
+    return true;
+}
+
+bool Uring::submit(bool wait) {
+
+    int count;
+
+    do
+        count = syscall(__NR_io_uring_enter, _fd, _pending, wait ? 1 : 0, wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    while (count < 0 && errno == EINTR);
+    if (count < 0)
+        return false;
+    _pending -= count;
+    return true;
+}
+
+bool Uring::complete(unsigned long &tag, int &result) {
+
+    unsigned head = *_cq_head;
+    io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(_cq_tail, __ATOMIC_ACQUIRE))
+        return false;
+    cqe = &_cqes[head & *_cq_mask];
+    tag = cqe->user_data;
+    result = cqe->res;
+    __atomic_store_n(_cq_head, head + 1, __ATOMIC_RELEASE);
+    return true;
+}
@@ -0,0 +1,63 @@
+/*
+  Copyright Xphysics 2012. All Rights Reserved.
+
+  SafeChat is free software: you can redistribute it and/or modify it under the
+  terms of the GNU General Public License as published by the Free Software
+  Foundation, either version 3 of the License, or (at your option) any later
+  version.
+
+  SafeChat is distributed in the hope that it will be useful, but WITHOUT ANY
+  WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS FOR
+  A PARTICULAR PURPOSE. See the GNU General Public License for more details.
+
+  <http://www.gnu.org/licenses/>
+ */
+
+#ifndef uring_h
+#define	uring_h
+
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+/*
+  Minimal io_uring submission and completion queue driven through the raw
+  system calls. Requests are prepared into the submission ring and handed
+  to the kernel in batches, optionally against buffers registered up front
+  so the kernel doesn't have to map them on every request. setup fails
+  cleanly on kernels without io_uring so callers can fall back.
+ */
+class Uring {
+public:
+
+    Uring();
+    ~Uring();
+
+    bool setup(int entries, unsigned char **buffers, int count, int size);
+    void teardown();
+    bool is_ready() const;
+    unsigned pending() const;
+    bool prepare(int op, int fd, int buffer, unsigned char *data, int size, long offset, unsigned long tag);
+    bool submit(bool wait);
+    bool complete(unsigned long &tag, int &result);
+
+private:
+
+    bool _fixed;
+    int _fd;
+    unsigned _pending;
+    unsigned *_sq_head, *_sq_tail, *_sq_mask, *_sq_array, *_cq_head, *_cq_tail, *_cq_mask;
+    size_t _sq_size, _cq_size, _sqes_size;
+    unsigned char *_sq_ring, *_cq_ring;
+    io_uring_sqe *_sqes;
+    io_uring_cqe *_cqes;
+
+};
+
+#endif